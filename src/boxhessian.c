@@ -0,0 +1,227 @@
+// implementation of the "box hessian" keypoint detector
+//
+// This is the same detector as the harressian (deepness = trace of the
+// hessian, roundness = det/trace^2), but the second derivatives are
+// approximated by box filters evaluated on a summed-area table of the image.
+// Thus, each scale costs O(1) per pixel and there is no pyramid, so that the
+// scales can be sampled much more finely than by octaves.
+
+#ifndef _BOXHESSIAN_C
+#define _BOXHESSIAN_C
+
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include "xmalloc.c"
+#include "harressian.c"
+
+#define BOXHESSIAN_SCALES_PER_OCTAVE 4
+#define BOXHESSIAN_MAX_SCALES 40
+
+// summed-area table of size (w+1)*(h+1), with a row and a column of zeros
+// (double precision, because sums of 8-bit images overflow the float mantissa)
+static double *build_summed_area_table(float *x, int w, int h)
+{
+	int W = w + 1;
+	double *S = xmalloc((w + 1) * (h + 1) * sizeof*S);
+	for (int i = 0; i < W; i++)
+		S[i] = 0;
+	for (int j = 0; j < h; j++)
+	{
+		double row = 0;
+		S[(j+1)*W] = 0;
+		for (int i = 0; i < w; i++)
+		{
+			row += x[j*w+i];
+			S[(j+1)*W+i+1] = S[j*W+i+1] + row;
+		}
+	}
+	return S;
+}
+
+// sum of the pixels inside the box [i0,i1] x [j0,j1] (inclusive bounds)
+static inline double box_sum(double *S, int W, int i0, int j0, int i1, int j1)
+{
+	return S[(j1+1)*W + i1+1] - S[j0*W + i1+1]
+	     - S[(j1+1)*W + i0]   + S[j0*W + i0];
+}
+
+// fill the table of lobe sizes: each one is the odd integer nearest to the
+// previous one times 2^(1/BOXHESSIAN_SCALES_PER_OCTAVE), or the next odd
+// integer if that is the same, so that the fine scales are all the odd sizes
+// (1, 3, 5 ... 17) and the coarse ones are geometric (21, 25, 29, 35 ...)
+static int boxhessian_lobe_sizes(int *out_l, int w, int h)
+{
+	float f = pow(2, 1 / (float)BOXHESSIAN_SCALES_PER_OCTAVE);
+	int n = 0, l = 1;
+	while (n < BOXHESSIAN_MAX_SCALES && 3 * l + 2 < fmin(w, h) / 2)
+	{
+		out_l[n++] = l;
+		int next = 2 * lrint((l * f - 1) / 2) + 1;
+		l = next > l ? next : l + 2;
+	}
+	return n;
+}
+
+// signed second derivatives along x and y, at the scale of lobe size "l"
+//
+// With l=1 the filters are exactly the finite differences of the harressian.
+// Each filter is normalized by the area of its lobes, so that the result
+// approximates l^2 times the second derivative, as in the pyramid at the
+// octave of step l.
+static inline void boxhessian_dxx_dyy(float *dxx, float *dyy,
+		double *S, int w, int i, int j, int l, float sign)
+{
+	int W = w + 1;
+	int a = l / 2;
+	int b = l - 1;
+	float k = sign / (l * (2.0 * l - 1));
+	double cx = box_sum(S, W, i - a, j - b, i + a, j + b);
+	double lx = box_sum(S, W, i - a - l, j - b, i - a - 1, j + b);
+	double rx = box_sum(S, W, i + a + 1, j - b, i + a + l, j + b);
+	double cy = box_sum(S, W, i - b, j - a, i + b, j + a);
+	double ty = box_sum(S, W, i - b, j - a - l, i + b, j - a - 1);
+	double by = box_sum(S, W, i - b, j + a + 1, i + b, j + a + l);
+	*dxx = k * (lx + rx - 2*cx);
+	*dyy = k * (ty + by - 2*cy);
+}
+
+// fill the map of deepness values (signed trace of the box hessian) at the
+// scale given by the lobe size "l" (an odd number)
+static void boxhessian_trace_map(float *out, double *S, int w, int h,
+		int l, float sign)
+{
+	int m = 3 * (l / 2) + 2; // margin where the filters fit in the image
+	for (int i = 0; i < w*h; i++)
+		out[i] = -INFINITY;
+	for (int j = m; j < h - m; j++)
+	for (int i = m; i < w - m; i++)
+	{
+		float dxx, dyy;
+		boxhessian_dxx_dyy(&dxx, &dyy, S, w, i, j, l, sign);
+		out[j*w+i] = dxx + dyy;
+	}
+}
+
+// mixed derivative (unsigned, since it only appears squared)
+static float boxhessian_dxy(double *S, int w, int i, int j, int l)
+{
+	int W = w + 1;
+	double tl = box_sum(S, W, i - l, j - l, i - 1, j - 1);
+	double tr = box_sum(S, W, i + 1, j - l, i + l, j - 1);
+	double bl = box_sum(S, W, i - l, j + 1, i - 1, j + l);
+	double br = box_sum(S, W, i + 1, j + 1, i + l, j + l);
+	// the quadrants have area l^2 and their centers are at distance (l+1)/2
+	// from the center, so this gives l^2 times the derivative, like dxx
+	return (tl + br - tr - bl) / ((l + 1.0) * (l + 1.0));
+}
+
+// whether the value at position "idx" is a local maximum of the 3x3 square
+static bool is_local_max_3x3(float *t, int w, int idx, float v)
+{
+	for (int dj = -1; dj <= 1; dj++)
+	for (int di = -1; di <= 1; di++)
+		if ((di || dj) && t[idx + dj*w + di] >= v)
+			return false;
+	return true;
+}
+
+static bool is_not_below_3x3(float *t, int w, int idx, float v)
+{
+	for (int dj = -1; dj <= 1; dj++)
+	for (int di = -1; di <= 1; di++)
+		if (t[idx + dj*w + di] > v)
+			return false;
+	return true;
+}
+
+// box hessian at all scales, with scale-space non-maximum suppression
+// xyst = (x position, y position, scale, score)
+// the output is ordered from coarse to fine scales, like harressian_ms
+int boxhessian_ms(float *out_xyst, int max_npoints, float *x, int w, int h,
+		float sigma, float kappa, float tau)
+{
+	float sign = kappa > 0 ? 1 : -1;
+	kappa = fabs(kappa);
+
+	// filter input image (the borders are kept unfiltered)
+	float *sx = xmalloc_float(w * h);
+	memcpy(sx, x, w*h*sizeof*x);
+	poor_man_gaussian_filter(sx, x, w, h, sigma);
+
+	// one integral image for all the scales
+	double *S = build_summed_area_table(sx, w, h);
+
+	// deepness at each scale (independent of each other)
+	int l[BOXHESSIAN_MAX_SCALES];
+	int nl = boxhessian_lobe_sizes(l, w, h);
+	float *t = xmalloc_float(nl * w * h);
+#pragma omp parallel for schedule(dynamic)
+	for (int k = 0; k < nl; k++)
+		boxhessian_trace_map(t + k*w*h, S, w, h, l[k], sign);
+
+	// extract the maxima, from coarse to fine
+	int n = 0;
+	for (int k = nl - 1; k >= 0; k--)
+	{
+		float *tk = t + k*w*h;
+		float *tp = k + 1 < nl ? t + (k+1)*w*h : NULL;
+		float *tm = k > 0      ? t + (k-1)*w*h : NULL;
+		int m = 3 * (l[k] / 2) + 3;
+		for (int j = m; j < h - m; j++)
+		for (int i = m; i < w - m; i++)
+		{
+			int idx = j*w + i;
+			float T = tk[idx];
+			if (!(T > tau)) continue;
+			if (!is_local_max_3x3(tk, w, idx, T)) continue;
+			if (tp && !is_not_below_3x3(tp, w, idx, T)) continue;
+			if (tm && !is_not_below_3x3(tm, w, idx, T)) continue;
+
+			// roundness criterion
+			float dxx, dyy;
+			boxhessian_dxx_dyy(&dxx, &dyy, S, w, i, j, l[k], sign);
+			float dxy = boxhessian_dxy(S, w, i, j, l[k]);
+			float D = dxx * dyy - dxy * dxy;
+			if (!(D - kappa * T * T > 0)) continue;
+
+			// sub-pixel and sub-scale localization
+			float ox = parabolic_minimum(-tk[idx-1], -T, -tk[idx+1]);
+			float oy = parabolic_minimum(-tk[idx-w], -T, -tk[idx+w]);
+			float os = parabolic_minimum(tm ? -tm[idx] : NAN, -T,
+			                             tp ? -tp[idx] : NAN);
+			float ls = log2(l[k]);
+			if (os < 0 && tm) ls += os * (ls - log2(l[k-1]));
+			if (os > 0 && tp) ls += os * (log2(l[k+1]) - ls);
+
+			out_xyst[4*n+0] = i + ox;
+			out_xyst[4*n+1] = j + oy;
+			out_xyst[4*n+2] = pow(2, ls) * 5 / 4;
+			out_xyst[4*n+3] = T;
+			n += 1;
+			if (n >= max_npoints)
+				goto done;
+		}
+	}
+done:
+	assert(n <= max_npoints);
+
+	// cleanup and exit
+	free(t);
+	free(S);
+	free(sx);
+	return n;
+}
+
+// box hessian with multi-scale exclusion (same interface as "harressian")
+int boxhessian(float *out_xyst, int max_npoints, float *x, int w, int h,
+		float sigma, float kappa, float tau)
+{
+	float *tmp_xyst = xmalloc_float(4 * max_npoints);
+	int n = boxhessian_ms(tmp_xyst, max_npoints, x, w, h, sigma,kappa,tau);
+	int r = remove_redundant_points(out_xyst, tmp_xyst, n);
+	free(tmp_xyst);
+	return r;
+}
+
+#endif//_BOXHESSIAN_C
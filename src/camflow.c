@@ -9,8 +9,14 @@
 
 #include "mauricio.c"         // function to compute Mauricio's blur detection
 #include "harressian.c"       // computation of Harris keypoints
+#include "boxhessian.c"       // same, using box filters on an integral image
+#include "harrtiles.c"        // re-use of harressian computations across frames
+#include "tracks.c"           // tracking of keypoint identities
+#include "klt.c"              // lucas-kanade tracking between detections
 #include "ransac.c"           // generic ransac algorithm
 #include "geometry.c"         // linear algebra and geometric computations
+#include "multiline.c"        // extraction of several lines in one pass
+#include "hough.c"            // hough transform, updated between frames
 
 #include "fontu.c"            // bitmap font library
 #include "seconds.c"          // function for computing running times
@@ -24,6 +30,7 @@ struct bitmap_font global_font; // globally visible fixed-width font (for HUD)
 // parameters of the algorithm (global variables, for easy testing)
 
 int    global_pyramid = 0;
+int    global_engine = 0;          // b (0=pyramid, 1=box filters)
 
 double global_harris_sigma = 1;    // s
 double global_harris_k = 0.24;     // k
@@ -34,6 +41,10 @@ int    global_harris_neigh = 1;    // n
 int    global_ransac_ntrials = 300; // r
 int    global_ransac_minliers = 22;    // i
 double global_ransac_maxerr = 1.5;    // e
+double global_ransac_confidence = 0.99; // (0 = always run all the trials)
+int    global_ransac_ntrials_used = 0; // statistics of the last frame
+int    global_ransac_lo = 1;       // o (local optimization of the lines)
+int    global_ransac_napsac = 0;   // a (local samples instead of scores)
 
 double global_mauricio_ssat = 200;
 double global_mauricio_gth = 40.00;
@@ -41,24 +52,109 @@ int    global_mauricio_Cth = 3000;
 double global_mauricio_Sth = 20.0;
 
 double global_tracker_toggle = 1;
+int    global_tracker_thread = 0;   // g (tracker pipelined on a thread)
 double global_histeresis_factor = 2;
 
+int    global_tiles_toggle = 0;     // c
+double global_tiles_th = 2;         // j (mean abs. difference of a tile)
+
+int    global_tracks_toggle = 0;    // y (identity tracker, windowed detection)
+int    global_tracks_period = 10;   // frames between full detections
+
+int    global_klt_toggle = 0;       // l (lucas-kanade between detections)
+int    global_klt_period = 10;      // frames between full detections
+double global_klt_min_quality = 0.6; // fraction of surviving tracks
+
+int    global_lines_toggle = 0;     // v (alignment lines, off by default)
+int    global_hough_toggle = 0;     // h (hough lines instead of ransac)
+int    global_multiline_toggle = 1; // m (one pool for all the lines)
+
+
+// options of the ransac of the lines
+// (the points are sampled by decreasing quality, if given)
+static struct ransac_options line_ransac_options(float *quality)
+{
+	struct ransac_options opt = {
+		.confidence = global_ransac_confidence,
+		.min_trials = 10,
+		.sprt = true,
+		.batch_error = distance_of_points_to_straight_line,
+		.sampler = global_ransac_napsac ? SAMPLER_NAPSAC :
+			quality ? SAMPLER_PROSAC : SAMPLER_FLOYD,
+		.quality = quality,
+		.napsac_global = 0.1,
+		.refine = global_ransac_lo ?
+			straight_line_by_total_least_squares : NULL };
+	return opt;
+}
 
 int find_straight_line_by_ransac(int *out_mask, float line[3],
-		float *points, int npoints,
+		float *points, float *quality, int npoints,
 		int ntrials, float max_err)
 {
 	if (npoints < 2)
 		return 0;
-	return ransac(out_mask, line, points, 2, npoints, 3,
+	struct ransac_options opt = line_ransac_options(quality);
+	int r = ransac_opt(out_mask, line, points, 2, npoints, 3,
 			distance_of_point_to_straight_line,
 			straight_line_through_two_points,
-			2, ntrials, 3, max_err, NULL, NULL);
+			2, ntrials, 3, max_err, NULL, NULL, &opt);
+	global_ransac_ntrials_used += opt.ntrials;
+	return r;
 }
 
-#include "tracker.c"
+// one ransac run for each line, removing the inliers of the previous lines
+// (the points and their qualities are overwritten)
+int find_straight_lines_by_ransac(float *out_lines, int *out_label,
+		int max_lines, float *points, float *quality, int npoints)
+{
+	int n = npoints, nlines = 0;
+	int *mask = xmalloc_int(n), *idx = xmalloc_int(n);
+	for (int i = 0; i < n; i++)
+	{
+		out_label[i] = -1;
+		idx[i] = i;
+	}
+	while (nlines < max_lines)
+	{
+		// find line
+		float *line = out_lines + 3*nlines;
+		int n_inliers = find_straight_line_by_ransac(mask, line,
+				points, quality, n,
+				global_ransac_ntrials,
+				global_ransac_maxerr);
+		if (n_inliers < global_ransac_minliers)
+			break;
+
+		// exclude the points of this line
+		int cx = 0;
+		for (int i = 0; i < n; i++)
+			if (mask[i])
+				out_label[idx[i]] = nlines;
+			else { // keep only the unused points
+				points[2*cx+0] = points[2*i+0];
+				points[2*cx+1] = points[2*i+1];
+				if (quality) quality[cx] = quality[i];
+				idx[cx++] = idx[i];
+			}
+		assert(cx + n_inliers == n);
+		n = cx;
+		nlines += 1;
+	}
+	free(idx);
+	free(mask);
+	return nlines;
+}
+
+#include "tracker_thread.c"
 
 static struct point_tracker global_tracker[1];
+static struct tracker_pipeline global_tracker_pipeline[1];
+static int global_tracker_pipeline_running = 0; // started by the first 'g'
+static struct harressian_tiles global_tiles[1];
+static struct track_set global_tracks[1];
+static struct klt_tracker global_klt[1];
+static struct hough_accumulator global_hough[1];
 
 // process one (float rgb) frame
 static void process_frgb_frame(float *out, float *in, int w, int h)
@@ -88,20 +184,90 @@ static void process_frgb_frame(float *out, float *in, int w, int h)
 	float tmp_point[4*max_keypoints];
 	int npoints = 0;
 	if (!global_pyramid) { // run regular harressian
+		// the identity tracker only needs the predicted windows, except
+		// for a periodic full detection that finds the new points
+		bool windowed = global_tracks_toggle && global_tracks->n
+			&& global_tracks->nframes < global_tracks_period;
+
+		// the lucas-kanade tracker follows the last detected points, until
+		// too many of them are lost
+		bool klt_step = global_klt_toggle && global_klt->n
+			&& global_klt->nframes + 1 < global_klt_period
+			&& klt_quality(global_klt) >= global_klt_min_quality;
+
 		// compute harressian points
-		int tmp_npoints = harressian(tmp_point, max_keypoints,
+		int tmp_npoints;
+		if (klt_step) {
+			tmp_npoints = klt_track(global_klt, gray,
+					global_harris_sigma);
+			for (int i = 0; i < 4*tmp_npoints; i++)
+				tmp_point[i] = global_klt->xyst[i];
+		} else if (windowed) {
+			int *rects = xmalloc_int(4 * global_tracks->n + 4);
+			int nrects = track_set_search_windows(rects,
+					global_tracks->n, global_tracks, 4, w, h);
+			tmp_npoints = harressian_windows(tmp_point, max_keypoints,
+				gray, w, h,
+				global_harris_sigma,
+				global_harris_k,
+				global_harris_flat_th,
+				rects, nrects, HARRESSIAN_WINDOW_TILE);
+			free(rects);
+		} else if (global_tiles_toggle && !global_engine)
+			tmp_npoints = harressian_tiles(tmp_point, max_keypoints,
+				global_tiles, gray,
+				global_harris_sigma,
+				global_harris_k,
+				global_harris_flat_th,
+				global_tiles_th);
+		else
+			tmp_npoints = (global_engine ? boxhessian : harressian)(
+				tmp_point, max_keypoints,
 				gray, w, h,
 				global_harris_sigma,
 				global_harris_k,
 				global_harris_flat_th);
 
 		// filter the points by the tracker
-		if (global_tracker_toggle) {
+		if (global_klt_toggle) {
+			if (!klt_step)
+				klt_reset(global_klt, gray, global_harris_sigma,
+						tmp_point, tmp_npoints);
+			npoints = tmp_npoints;
+			for (int i = 0; i < 4*npoints; i++)
+				point[i] = tmp_point[i];
+		} else if (global_tracks_toggle) {
+			if (!windowed)
+				global_tracks->nframes = 0;
+			track_set_update(global_tracks, tmp_point, tmp_npoints);
+			npoints = track_set_extract(point, NULL, max_keypoints,
+					global_tracks, 2);
+		} else if (global_tracker_toggle) {
 			float h_hi = global_harris_flat_th * global_histeresis_factor;
-			point_tracker_add_frame_t(global_tracker,
-					tmp_point,tmp_npoints, h_hi);
-			npoints = point_tracker_extract_points(point,
-					global_tracker);
+			if (global_tracker_thread) {
+				if (!global_tracker_pipeline_running)
+					tracker_pipeline_start(
+						global_tracker_pipeline,
+						global_tracker, 2000, 1);
+				global_tracker_pipeline_running = 1;
+				// the points shown are those of the previous frame
+				npoints = tracker_pipeline_update(
+						global_tracker_pipeline, point,
+						tmp_point, tmp_npoints, h_hi);
+				if (npoints < 0) npoints = 0;
+			} else {
+				if (global_tracker_pipeline_running) {
+					tracker_pipeline_flush(
+						global_tracker_pipeline);
+					tracker_pipeline_stop(
+						global_tracker_pipeline);
+				}
+				global_tracker_pipeline_running = 0;
+				point_tracker_add_frame_t(global_tracker,
+						tmp_point,tmp_npoints, h_hi);
+				npoints = point_tracker_extract_points(point,
+						max_keypoints, global_tracker);
+			}
 		} else {
 			npoints = tmp_npoints;
 			for (int i = 0; i < 4*npoints; i++)
@@ -179,51 +345,60 @@ static void process_frgb_frame(float *out, float *in, int w, int h)
 	}
 
 	// compute ransac
-	if (0 && npoints > 1)
+	global_ransac_ntrials_used = 0;
+	if (global_lines_toggle && npoints > 1)
 	{
 		// data for ransac
 		int n = npoints;
-		int *mask = xmalloc_int(n);
+		int *label = xmalloc_int(n);
 		float *keypoints = xmalloc_float(2 * n);
+		float *score = xmalloc_float(n);
 		for (int i = 0; i < n; i++)
-		for (int l = 0; l < 2; l++)
-			keypoints[2*i+l] = point[4*i+l];
-
-		for (int i = 0; i < 10; i++)
 		{
-			// find line
-			float line[3];
-			int n_inliers = find_straight_line_by_ransac(mask, line,
-					keypoints, n,
-					global_ransac_ntrials,
+			for (int l = 0; l < 2; l++)
+				keypoints[2*i+l] = point[4*i+l];
+			score[i] = point[4*i+3];
+		}
+
+		// find the lines, on one pool of hypotheses, by one ransac run
+		// for each line, or on the peaks of the hough accumulator
+		int max_lines = 10, nlines;
+		float line[3*max_lines];
+		if (global_hough_toggle) {
+			hough_update(global_hough, point, n);
+			nlines = hough_lines(line, label, max_lines,
+					global_hough, global_ransac_minliers,
+					global_ransac_minliers,
 					global_ransac_maxerr);
-			if (n_inliers < global_ransac_minliers)
-				break;
-			double dline[3] = {line[0], line[1], line[2]};
+		} else if (global_multiline_toggle) {
+			struct ransac_options opt = line_ransac_options(score);
+			nlines = multiline_extract(line, label, max_lines,
+					keypoints, n, global_ransac_ntrials,
+					global_ransac_minliers,
+					global_ransac_maxerr, &opt);
+			global_ransac_ntrials_used = opt.ntrials;
+		} else {
+			nlines = find_straight_lines_by_ransac(line, label,
+					max_lines, keypoints, score, n);
+		}
+		for (int i = 0; i < nlines; i++)
+		{
+			double dline[3] = {line[3*i+0], line[3*i+1], line[3*i+2]};
 			double rectangle[4] = {0, 0, w, h};
 			double segment[4];
-			cut_line_with_rectangle(segment, segment+2,
-					dline, rectangle, rectangle+2);
+			if (!cut_line_with_rectangle(segment, segment+2,
+					dline, rectangle, rectangle+2))
+				continue;
 			int ifrom[2] = {round(segment[0]), round(segment[1])};
 			int ito[2] = {round(segment[2]), round(segment[3])};
 			float fred[3] = {0, 0, 255};
 			draw_segment_frgb(out, w, h, ifrom, ito, fred);
-			// exclude the points of this segment
-			int cx = 0;
-			for (int i = 0; i < n; i++)
-				if (!mask[i]) // keep only the unused points
-				{
-					keypoints[2*cx+0] = keypoints[2*i+0];
-					keypoints[2*cx+1] = keypoints[2*i+1];
-					cx++;
-				}
-			assert(cx + n_inliers == n);
-			n = cx;
 		}
 
 		// cleanup
+		free(score);
 		free(keypoints);
-		free(mask);
+		free(label);
 	}
 
 	free(gray);
@@ -238,10 +413,16 @@ static void process_frgb_frame(float *out, float *in, int w, int h)
 	float fg[] = {0, 255, 0}, red[] = {0, 0, 255};
 	put_string_in_float_image(out,w,h,3, 5,5, fg, 0, &global_font, buf);
 	snprintf(buf, 1000, "ransac ntrials = %d\nransac minliers = %d\n"
-			"ransac maxerr = %g",
+			"ransac maxerr = %g\nransac used = %d\nransac lo = %s\n"
+			"ransac lines = %s",
 			global_ransac_ntrials,
 			global_ransac_minliers,
-			global_ransac_maxerr);
+			global_ransac_maxerr,
+			global_ransac_ntrials_used,
+			global_ransac_lo ? "on" : "off",
+			!global_lines_toggle ? "off" :
+			global_hough_toggle ? "hough" :
+			global_multiline_toggle ? "pool" : "sequential");
 	put_string_in_float_image(out,w,h,3, 155,5, fg, 0, &global_font, buf);
 
 	//snprintf(buf, 1000, "mauricio: %s", mauricio?"sharp":"blurred");
@@ -249,9 +430,32 @@ static void process_frgb_frame(float *out, float *in, int w, int h)
 			mauricio?fg:red, 0, &global_font, "mauricio: disabled");
 
 	put_string_in_float_image(out,w,h,3, 355,31, fg, 0, &global_font,
-	       	global_tracker_toggle?"tracker: ENABLED":"tracker: disabled");
+	       	!global_tracker_toggle ? "tracker: disabled" :
+		global_tracker_thread ? "tracker: ENABLED (thread)" :
+		"tracker: ENABLED");
 	snprintf(buf, 1000, "\n\n\nh factor = %g", global_histeresis_factor);
 	put_string_in_float_image(out,w,h,3, 355,5, fg, 0, &global_font, buf);
+	put_string_in_float_image(out,w,h,3, 355,57, fg, 0, &global_font,
+	       	global_engine?"engine: box":"engine: pyramid");
+	if (global_tiles_toggle)
+		snprintf(buf, 1000, "tiles: %d/%d (th=%g)",
+				global_tiles->ndirty, global_tiles->ntiles,
+				global_tiles_th);
+	else
+		snprintf(buf, 1000, "tiles: disabled");
+	put_string_in_float_image(out,w,h,3, 355,70, fg, 0, &global_font, buf);
+	if (global_tracks_toggle)
+		snprintf(buf, 1000, "tracks: %d (next id %d)",
+				global_tracks->n, global_tracks->next_id);
+	else
+		snprintf(buf, 1000, "tracks: disabled");
+	put_string_in_float_image(out,w,h,3, 355,83, fg, 0, &global_font, buf);
+	if (global_klt_toggle)
+		snprintf(buf, 1000, "klt: %d/%d (frame %d)", global_klt->n,
+				global_klt->n0, global_klt->nframes);
+	else
+		snprintf(buf, 1000, "klt: disabled");
+	put_string_in_float_image(out,w,h,3, 355,96, fg, 0, &global_font, buf);
 
 	framerate = seconds() - framerate;
 	snprintf(buf, 1000, "%g Hz", 1/framerate);
@@ -281,7 +485,7 @@ int main( int argc, char *argv[] )
 	int cam_id = atoi(argv[1]);
 
 	global_font = uncompress_font(*xfont_8x13); // prepare font for HUD
-	point_tracker_init(global_tracker, 20);
+	point_tracker_init(global_tracker, 20, 2000);
 
 	// interactivity state
 	CvCapture *capture = 0;
@@ -324,6 +528,11 @@ int main( int argc, char *argv[] )
 		frgb_in[3*i+2] = g;
 	}
 
+	harressian_tiles_init(global_tiles, W, H, 32, 2000);
+	track_set_init(global_tracks, 2000);
+	klt_init(global_klt, W, H, 2000);
+	hough_init(global_hough, W, H, 180, 2, true, 2000);
+
 	/* create a window for the video */
 	cvNamedWindow( "result", CV_WINDOW_FREERATIO );
 	cvResizeWindow("result", W, H);
@@ -382,8 +591,20 @@ int main( int argc, char *argv[] )
 		if (key == 'e') global_ransac_maxerr /= wheel_factor;
 		if (key == 'E') global_ransac_maxerr *= wheel_factor;
 		if (key == 'w') global_harris_k *= -1;
+		if (key == 'o') global_ransac_lo = !global_ransac_lo;
+		if (key == 'a') global_ransac_napsac = !global_ransac_napsac;
 		if (key == 'p') global_pyramid = !global_pyramid;
+		if (key == 'b') global_engine = !global_engine;
+		if (key == 'c') global_tiles_toggle = !global_tiles_toggle;
+		if (key == 'y') global_tracks_toggle = !global_tracks_toggle;
+		if (key == 'l') global_klt_toggle = !global_klt_toggle;
+		if (key == 'v') global_lines_toggle = !global_lines_toggle;
+		if (key == 'h') global_hough_toggle = !global_hough_toggle;
+		if (key == 'm') global_multiline_toggle = !global_multiline_toggle;
+		if (key == 'j') global_tiles_th /= wheel_factor;
+		if (key == 'J') global_tiles_th *= wheel_factor;
 		if (key == 'z') global_tracker_toggle = !global_tracker_toggle;
+		if (key == 'g') global_tracker_thread = !global_tracker_thread;
 		if (key == 'x') global_histeresis_factor /= wheel_factor;
 		if (key == 'X') global_histeresis_factor *= wheel_factor;
 		if (isalpha(key)) {
@@ -396,6 +617,8 @@ int main( int argc, char *argv[] )
 	}
 
 	/* free memory */
+	if (global_tracker_pipeline_running)
+		tracker_pipeline_stop(global_tracker_pipeline);
 	cvDestroyWindow( "result" );
 	cvReleaseCapture( &capture );
 
@@ -0,0 +1,127 @@
+// catalog of reference constellations, stored in a text file
+//
+// Each constellation is given by a line with its name and its number of dots
+// n, followed by n lines with the coordinates "x y" of its dots.  The empty
+// lines and the lines starting with '#' are ignored.  For example:
+//
+//	# label designs
+//	cereal-box 4
+//	0 0
+//	10 2.5
+//	3 7
+//	8 9
+//	milk 3
+//	...
+//
+// The dots are loaded in the layout expected by "constellation_index_build":
+// those of the constellation l are xy[2*start[l]] ... xy[2*start[l+1]-1].
+
+#ifndef _CATALOG_C
+#define _CATALOG_C
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fail.c"
+#include "xmalloc.c"
+#include "xfopen.c"
+
+#define CATALOG_NAME 64 // maximum length of the names
+
+struct catalog {
+	int nlabels;        // number of constellations
+	char (*name)[CATALOG_NAME]; // name of each constellation
+	int *start;         // first dot of each constellation (and nlabels+1)
+	float *xy;          // coordinates of the dots
+};
+
+// next line of the file that is not empty nor a comment
+static char *catalog_line(char *s, int n, FILE *f)
+{
+	while (fgets(s, n, f))
+	{
+		char *p = s + strspn(s, " \t\r\n");
+		if (*p && *p != '#')
+			return p;
+	}
+	return NULL;
+}
+
+// API: read a catalog file
+void catalog_load(struct catalog *c, char *filename)
+{
+	FILE *f = xfopen(filename, "r");
+	int cap = 16, dcap = 1024, ndots = 0;
+	c->nlabels = 0;
+	c->name = xmalloc(cap * sizeof*c->name);
+	c->start = xmalloc_int(cap + 1);
+	c->xy = xmalloc_float(2 * dcap);
+	char s[1024], *p;
+	while ((p = catalog_line(s, sizeof s, f)))
+	{
+		int n;
+		char name[CATALOG_NAME];
+		if (2 != sscanf(p, "%63s %d", name, &n) || n < 0)
+			fail("catalog_load: bad line \"%s\" in \"%s\"",
+					p, filename);
+		if (c->nlabels == cap) {
+			cap *= 2;
+			c->name = realloc(c->name, cap * sizeof*c->name);
+			c->start = realloc(c->start, (cap + 1) * sizeof*c->start);
+			if (!c->name || !c->start)
+				fail("catalog_load: out of memory");
+		}
+		strcpy(c->name[c->nlabels], name);
+		c->start[c->nlabels] = ndots;
+		for (int i = 0; i < n; i++)
+		{
+			if (ndots == dcap) {
+				dcap *= 2;
+				c->xy = realloc(c->xy, 2 * dcap * sizeof*c->xy);
+				if (!c->xy) fail("catalog_load: out of memory");
+			}
+			p = catalog_line(s, sizeof s, f);
+			if (!p || 2 != sscanf(p, "%g %g", c->xy + 2*ndots,
+						c->xy + 2*ndots + 1))
+				fail("catalog_load: missing dots of \"%s\" in "
+						"\"%s\"", name, filename);
+			ndots += 1;
+		}
+		c->nlabels += 1;
+	}
+	c->start[c->nlabels] = ndots;
+	xfclose(f);
+}
+
+// API: write a catalog file
+void catalog_save(struct catalog *c, char *filename)
+{
+	FILE *f = xfopen(filename, "w");
+	fprintf(f, "# %d constellations\n", c->nlabels);
+	for (int l = 0; l < c->nlabels; l++)
+	{
+		fprintf(f, "%s %d\n", c->name[l], c->start[l+1] - c->start[l]);
+		for (int i = c->start[l]; i < c->start[l+1]; i++)
+			fprintf(f, "%.9g %.9g\n", c->xy[2*i], c->xy[2*i+1]);
+	}
+	xfclose(f);
+}
+
+// API: index of the constellation of the given name, or -1
+int catalog_find(struct catalog *c, char *name)
+{
+	for (int l = 0; l < c->nlabels; l++)
+		if (!strcmp(c->name[l], name))
+			return l;
+	return -1;
+}
+
+// API
+void catalog_free(struct catalog *c)
+{
+	free(c->name);
+	free(c->start);
+	free(c->xy);
+}
+
+#endif//_CATALOG_C
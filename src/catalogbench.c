@@ -0,0 +1,97 @@
+// per-frame time of the recognition of constellations against catalog size
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "catalog.c"
+#include "constellation.c"
+#include "constellation_synth.c"
+#include "pickopt.c"
+#include "seconds.c"
+
+// catalog of "nlabels" random constellations of "ndots" dots
+static void random_catalog(struct catalog *c, int nlabels, int ndots)
+{
+	c->nlabels = nlabels;
+	c->name = xmalloc(nlabels * sizeof*c->name);
+	c->start = xmalloc_int(nlabels + 1);
+	c->xy = xmalloc_float(2 * nlabels * ndots);
+	for (int l = 0; l < nlabels; l++)
+		snprintf(c->name[l], CATALOG_NAME, "label%d", l);
+	synth_constellations(c->xy, c->start, nlabels, ndots);
+}
+
+// recognize "nrep" frames with the first "m" constellations of the catalog
+static void bench(struct catalog *c, int m, int nclutter, int k, float tol,
+		int nrep)
+{
+	struct constellation_index ci[1];
+	double t = seconds();
+	constellation_index_build(ci, c->xy, c->start, m, k, tol);
+	t = seconds() - t;
+	double mb = (ci->npostings * sizeof*ci->posting
+			+ ((1L << ci->bits) + 1) * sizeof*ci->bucket
+			+ (long)c->start[m] * k * sizeof*ci->neighbors) / 1048576.0;
+
+	int maxdots = 0;
+	for (int l = 0; l < m; l++)
+		if (maxdots < c->start[l+1] - c->start[l])
+			maxdots = c->start[l+1] - c->start[l];
+	float *f = xmalloc_float(2 * (maxdots + nclutter));
+	double t_match = 0;
+	int ngood = 0;
+	for (int r = 0; r < nrep; r++)
+	{
+		int l = rand() % m;
+		float H[9];
+		synth_homography(H, 0.001);
+		int n = synth_frame(f, c->xy + 2*c->start[l],
+				c->start[l+1] - c->start[l], H, nclutter);
+		struct constellation_match o[1];
+		double t0 = seconds();
+		constellation_matching(o, ci, f, n, k + 2, 5, 3, 10, r);
+		t_match += seconds() - t0;
+		ngood += o->label == l && o->ninliers > 0;
+	}
+	printf("%6d %10d %8.1f %10.1f %10.3f %6d/%d\n", m, ci->npostings, mb,
+			1000 * t, 1000 * t_match / nrep, ngood, nrep);
+	free(f);
+	constellation_index_free(ci);
+}
+
+int main(int c, char *v[])
+{
+	// extract named options
+	int nlabels = atoi(pick_option(&c, &v, "l", "3000"));
+	int ndots = atoi(pick_option(&c, &v, "d", "60"));
+	int nclutter = atoi(pick_option(&c, &v, "c", "300"));
+	int k = atoi(pick_option(&c, &v, "k", "6"));
+	float tol = atof(pick_option(&c, &v, "t", "0.01"));
+	int nrep = atoi(pick_option(&c, &v, "r", "20"));
+	char *filename_out = pick_option(&c, &v, "w", "");
+	if (c != 1 && c != 2)
+		return fprintf(stderr, "usage:\n\t%s [-l nlabels] [-d ndots] "
+				"[-c nclutter] [-k neighbors] [-t tol] "
+				"[-r nrep] [-w out.cat] [in.cat]\n", *v);
+
+	// random catalog, or the given one
+	srand(1);
+	struct catalog cat[1];
+	if (c == 2)
+		catalog_load(cat, v[1]);
+	else
+		random_catalog(cat, nlabels, ndots);
+	if (*filename_out)
+		catalog_save(cat, filename_out);
+	printf("catalog of %d constellations, %d dots\n", cat->nlabels,
+			cat->start[cat->nlabels]);
+
+	// growing prefixes of the catalog
+	printf("labels   postings       MB   build ms   ms/frame recognized\n");
+	int size[] = {10, 30, 100, 300, 1000, 3000, 10000, 30000};
+	for (int i = 0; i < 8 && size[i] < cat->nlabels; i++)
+		bench(cat, size[i], nclutter, k, tol, nrep);
+	bench(cat, cat->nlabels, nclutter, k, tol, nrep);
+
+	catalog_free(cat);
+	return 0;
+}
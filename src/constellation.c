@@ -1,16 +1,652 @@
-// simplest constellation matching
+// recognition of constellations of dots by geometric hashing
+//
+// A constellation is the pattern of dots of a reference label.  Offline, each
+// dot "p" forms tuples with its k nearest neighbors: a triangle (p, a, b) and
+// a fourth point d.  The key of a tuple is invariant to similarities: the
+// ratios of the two shortest sides of the triangle to the longest one, its
+// orientation, and the coordinates of d in the frame of the triangle.  The
+// vertices of the triangle are ordered by the lengths of the opposite sides,
+// so that the key also gives the correspondence of the four points.
+//
+// The quantized keys form an inverted index of the postings (constellation,
+// tuple).  The postings are sorted by buckets of the hash of their key, with
+// the low bits of the hash to tell the keys of a bucket apart, so that a
+// lookup costs one access to the bucket table and one to the postings.  The
+// tuple is coded in 32 bits by its dot and the neighbor slots of its four
+// points, so that a posting takes 12 bytes and a catalog of thousands of
+// constellations fits in memory.
+//
+// Online, the tuples of the keypoints of the frame are formed in the same way
+// and each one is looked up in the table (at most 16 bins around its key, to
+// absorb the noise).  Each posting found votes for its constellation and for
+// its four correspondences.  Only the constellations with most votes are
+// verified, by ransac of a homography on their voted correspondences, so that
+// the cost of the recognition is a fixed number of lookups per keypoint,
+// instead of the combinations of keypoints and dots of a direct matching.
 
-struct constellation {
-	int n;     // number of stars
-	float *xy; // coordinates of the stars
+#ifndef _CONSTELLATION_C
+#define _CONSTELLATION_C
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fail.c"
+#include "xmalloc.c"
+#include "geometry.c"
+#include "ransac.c"
+#include "ransac_models.c"
+
+#define CONSTELLATION_MAX_K 16  // maximum number of neighbors of each point
+#define CONSTELLATION_MAX_UV 3  // maximum coordinates of the fourth point
+#define CONSTELLATION_SELF 15   // neighbor slot of the dot of a tuple
+
+struct constellation_posting {
+	uint32_t check;     // low bits of the hash of the key
+	uint32_t label;     // constellation
+	uint32_t tuple;     // its tuple (see constellation_tuple_dots)
+};
+
+struct constellation_index {
+	int nlabels;        // number of constellations
+	int *start;         // first dot of each constellation (and nlabels+1)
+	float *xy;          // coordinates of the dots of all the constellations
+	int k;              // neighbors of each dot used to form the tuples
+	float tol;          // tolerance on the invariants (the bins are 2*tol)
+	int *neighbors;     // the k nearest neighbors of each dot (or -1)
+
+	// inverted index, by buckets of the hash of the keys
+	int bits;           // log2 of the number of buckets
+	uint32_t *bucket;   // first posting of each bucket (and the end)
+	int npostings;
+	struct constellation_posting *posting;
 };
 
-int constellation_matching(double out_H[9],
-		float *sky, int nsky, float *constellation, int nconst)
+// the recognized constellation
+struct constellation_match {
+	int label;          // index of the constellation (or -1)
+	int nvotes;         // bases of the frame matched to it
+	int ncorrespondences; // distinct correspondences given by the votes
+	int ninliers;       // correspondences verified by the homography
+	float H[9];         // homography from the constellation to the image
+};
+
+// indices of the k nearest neighbors of each point, by increasing distance
+// (in out[k*i+j], or -1 when there are less than k other points)
+// The points are bucketed in a grid, whose cells are visited in rings around
+// each point until the k-th neighbor is closer than the next ring.
+static void constellation_neighbors(int *out, float *xy, int n, int k)
+{
+	if (n < 1) return;
+	float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+	for (int i = 0; i < n; i++)
+	{
+		x0 = fmin(x0, xy[2*i+0]); x1 = fmax(x1, xy[2*i+0]);
+		y0 = fmin(y0, xy[2*i+1]); y1 = fmax(y1, xy[2*i+1]);
+	}
+	float cs = sqrt((x1 - x0) * (y1 - y0) * k / n); // about k points by cell
+	cs = fmax(cs, fmax(x1 - x0, y1 - y0) / 1024);
+	cs = fmax(cs, 1e-6);
+	int gw = 1 + (x1 - x0) / cs, gh = 1 + (y1 - y0) / cs;
+
+	// points sorted by cells
+	int *cell = xmalloc_int(n);
+	int *start = xmalloc_int(gw*gh + 1);
+	int *idx = xmalloc_int(n);
+	for (int q = 0; q <= gw*gh; q++)
+		start[q] = 0;
+	for (int i = 0; i < n; i++)
+	{
+		int ix = fmin(gw - 1, (xy[2*i+0] - x0) / cs);
+		int iy = fmin(gh - 1, (xy[2*i+1] - y0) / cs);
+		cell[i] = iy * gw + ix;
+		start[cell[i]+1] += 1;
+	}
+	for (int q = 0; q < gw*gh; q++)
+		start[q+1] += start[q];
+	for (int i = 0; i < n; i++) // (start is shifted by one cell)
+		idx[start[cell[i]]++] = i;
+	for (int q = gw*gh; q > 0; q--)
+		start[q] = start[q-1];
+	start[0] = 0;
+
+	for (int i = 0; i < n; i++)
+	{
+		float x = xy[2*i+0], y = xy[2*i+1];
+		int cx = cell[i] % gw, cy = cell[i] / gw;
+		float bd[CONSTELLATION_MAX_K];
+		int bi[CONSTELLATION_MAX_K], m = 0;
+		for (int r = 0; r <= gw || r <= gh; r++)
+		{
+			for (int dy = -r; dy <= r; dy++)
+			for (int dx = -r; dx <= r; dx += abs(dy) == r ? 1 : 2*r)
+			{
+				int ix = cx + dx, iy = cy + dy;
+				if (ix < 0 || iy < 0 || ix >= gw || iy >= gh)
+					continue;
+				int *s = start + iy*gw + ix;
+				for (int p = s[0]; p < s[1]; p++)
+				{
+					int j = idx[p];
+					float d = hypot(xy[2*j] - x, xy[2*j+1] - y);
+					if (j == i || (m == k && d >= bd[k-1]))
+						continue;
+					int q = m < k ? m++ : k - 1;
+					for (; q > 0 && bd[q-1] > d; q--)
+					{
+						bd[q] = bd[q-1];
+						bi[q] = bi[q-1];
+					}
+					bd[q] = d;
+					bi[q] = j;
+				}
+			}
+			// (the points of the next rings are farther than r*cs)
+			if (m == k && bd[k-1] <= r * cs)
+				break;
+		}
+		for (int j = 0; j < k; j++)
+			out[k*i+j] = j < m ? bi[j] : -1;
+	}
+	free(idx);
+	free(start);
+	free(cell);
+}
+
+// canonical order of the triangle (p, a, b) in "v", and its invariants
+// q[0], q[1] (ratios of the sides) and q[2] (orientation)
+// returns false when the order or the orientation are unstable (two sides of
+// nearly the same length, or nearly aligned points)
+static bool constellation_triangle(float q[3], int v[3], float *xy,
+		int p, int a, int b, float tol)
+{
+	int t[3] = {p, a, b};
+	float L[3]; // side opposite to each vertex
+	for (int j = 0; j < 3; j++)
+	{
+		float *P = xy + 2*t[(j+1)%3], *Q = xy + 2*t[(j+2)%3];
+		L[j] = hypot(P[0] - Q[0], P[1] - Q[1]);
+	}
+	int o[3] = {0, 1, 2};
+	for (int i = 1; i < 3; i++)
+	for (int j = i; j > 0 && L[o[j]] > L[o[j-1]]; j--)
+	{
+		int s = o[j]; o[j] = o[j-1]; o[j-1] = s;
+	}
+	float l = L[o[0]];
+	if (!(l > 0) || L[o[0]] - L[o[1]] < tol * l
+			|| L[o[1]] - L[o[2]] < tol * l)
+		return false;
+	for (int j = 0; j < 3; j++)
+		v[j] = t[o[j]];
+	float *A = xy + 2*v[0], *B = xy + 2*v[1], *C = xy + 2*v[2];
+	float cross = (B[0]-A[0]) * (C[1]-A[1]) - (B[1]-A[1]) * (C[0]-A[0]);
+	if (fabs(cross) < tol * l * l)
+		return false;
+	q[0] = L[o[1]] / l;
+	q[1] = L[o[2]] / l;
+	q[2] = cross > 0;
+	return true;
+}
+
+// coordinates q[3], q[4] of the point d in the frame of the triangle v
+// (origin at v[0], and v[1] at (1,0))
+static bool constellation_fourth_point(float q[5], int v[3], float *xy, int d)
+{
+	float *A = xy + 2*v[0], *B = xy + 2*v[1], *D = xy + 2*d;
+	float ex = B[0] - A[0], ey = B[1] - A[1], e2 = ex*ex + ey*ey;
+	float dx = D[0] - A[0], dy = D[1] - A[1];
+	q[3] = (ex*dx + ey*dy) / e2;
+	q[4] = (ex*dy - ey*dx) / e2;
+	return fabs(q[3]) < CONSTELLATION_MAX_UV
+		&& fabs(q[4]) < CONSTELLATION_MAX_UV;
+}
+
+// bin of the invariant q[j] (the coordinates are shifted to be positive)
+static int constellation_bin(float x, int j, float tol)
+{
+	float lo = j < 2 ? 0 : -CONSTELLATION_MAX_UV - 2*tol;
+	return fmax(0, floor((x - lo) / (2*tol)));
+}
+
+// key of the bins of the five invariants (16 bits for each bin)
+static uint64_t constellation_key(int o, int i1, int i2, int iu, int iw)
+{
+	return (uint64_t)o | (uint64_t)i1 << 1 | (uint64_t)i2 << 17
+		| (uint64_t)iu << 33 | (uint64_t)iw << 49;
+}
+
+static uint32_t constellation_hash(uint64_t key, int bits)
 {
-	struct constellation c[1] = {{nconst, constellation}};
-	int *mask = xmalloc(nsky * sizeof*mask);
-	int r = ransac(mask, out_H, sky, 2,  );
-	free(mask);
-	return r;
+	return (key * 0x9e3779b97f4a7c15) >> (64 - bits);
 }
+
+// bits of the key, mixed (finalizer of splitmix64)
+static uint64_t constellation_mix(uint64_t key)
+{
+	uint64_t z = key;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+// dots of the tuple of the constellation l, in canonical order
+// (the tuple is p << 16 | s0 << 12 | s1 << 8 | s2 << 4 | s3, where p is the
+// dot of the tuple in the constellation and s0...s3 the slots of its points
+// among the neighbors of p, or CONSTELLATION_SELF for p itself)
+static void constellation_tuple_dots(int r[4], struct constellation_index *c,
+		int l, uint32_t tuple)
+{
+	int p = c->start[l] + (tuple >> 16);
+	for (int j = 0; j < 4; j++)
+	{
+		int s = tuple >> (12 - 4*j) & 15;
+		r[j] = s == CONSTELLATION_SELF ? p : c->neighbors[c->k * p + s];
+	}
+}
+
+// call "f" on each tuple of the constellation l, with its key and its code
+static void constellation_tuples(struct constellation_index *c, int l,
+		void (*f)(struct constellation_index *, int, uint64_t,
+			uint32_t, void *), void *usr)
+{
+	int k = c->k;
+	float tol = c->tol;
+	for (int p = c->start[l]; p < c->start[l+1]; p++)
+	for (int a = 0; a < k; a++)
+	for (int b = a + 1; b < k; b++)
+	{
+		int *N = c->neighbors + k*p, v[3];
+		float q[5];
+		if (N[b] < 0 || !constellation_triangle(q, v, c->xy, p,
+					N[a], N[b], tol))
+			continue;
+		uint32_t tuple = (uint32_t)(p - c->start[l]) << 16;
+		for (int t = 0; t < 3; t++)
+			tuple |= (v[t] == p ? CONSTELLATION_SELF :
+					v[t] == N[a] ? a : b) << (12 - 4*t);
+		for (int j = 0; j < k; j++)
+		{
+			if (N[j] < 0 || j == a || j == b ||
+				!constellation_fourth_point(q, v, c->xy, N[j]))
+				continue;
+			uint64_t key = constellation_key(q[2],
+					constellation_bin(q[0], 0, tol),
+					constellation_bin(q[1], 1, tol),
+					constellation_bin(q[3], 3, tol),
+					constellation_bin(q[4], 4, tol));
+			f(c, l, key, tuple | j, usr);
+		}
+	}
+}
+
+// count the tuples in *usr, or in the buckets when usr is NULL
+static void constellation_count_tuple(struct constellation_index *c, int l,
+		uint64_t key, uint32_t tuple, void *usr)
+{
+	(void)l; (void)tuple;
+	if (usr)
+		*(long *)usr += 1;
+	else
+		c->bucket[(constellation_mix(key) >> (64 - c->bits)) + 1] += 1;
+}
+
+static void constellation_add_tuple(struct constellation_index *c, int l,
+		uint64_t key, uint32_t tuple, void *usr)
+{
+	uint32_t *cursor = usr;
+	uint64_t h = constellation_mix(key);
+	struct constellation_posting *P = c->posting
+		+ cursor[h >> (64 - c->bits)]++;
+	P->check = h;
+	P->label = l;
+	P->tuple = tuple;
+}
+
+// API: index the "nlabels" constellations given by their dots
+// "xy" has the coordinates of the dots of all the constellations, those of
+// the constellation l are xy[2*start[l]] ... xy[2*start[l+1]-1]
+// "k" is the number of neighbors of each dot (for example 6) and "tol" the
+// tolerance of the invariants (for example 0.02)
+void constellation_index_build(struct constellation_index *c,
+		float *xy, int *start, int nlabels, int k, float tol)
+{
+	if (k < 3 || k >= CONSTELLATION_SELF)
+		fail("constellation_index_build: bad number of neighbors %d", k);
+	if (!(tol >= 0.001))
+		fail("constellation_index_build: tolerance %g too small", tol);
+	int ndots = start[nlabels];
+	c->nlabels = nlabels;
+	c->k = k;
+	c->tol = tol;
+	c->start = xmalloc_int(nlabels + 1);
+	memcpy(c->start, start, (nlabels + 1) * sizeof*start);
+	c->xy = xmalloc_float(2 * (ndots ? ndots : 1));
+	memcpy(c->xy, xy, 2 * ndots * sizeof*xy);
+
+	// neighbors of the dots, inside each constellation
+	c->neighbors = xmalloc_int(k * (ndots ? ndots : 1));
+	for (int l = 0; l < nlabels; l++)
+	{
+		int m = start[l+1] - start[l], *nb = c->neighbors + k*start[l];
+		if (m > 1 << 16)
+			fail("constellation_index_build: %d dots in the "
+					"constellation %d", m, l);
+		constellation_neighbors(nb, xy + 2*start[l], m, k);
+		for (int i = 0; i < k * m; i++)
+			if (nb[i] >= 0)
+				nb[i] += start[l];
+	}
+
+	// count the tuples, and choose about one posting per bucket (so that
+	// most of the lookups of absent keys stop at the table of buckets)
+	long n = 0;
+	for (int l = 0; l < nlabels; l++)
+		constellation_tuples(c, l, constellation_count_tuple, &n);
+	if (n >= INT32_MAX)
+		fail("constellation_index_build: too many tuples (%ld)", n);
+	c->bits = 4;
+	while ((1L << c->bits) < n)
+		c->bits += 1;
+	int nb = 1 << c->bits;
+
+	// sort the postings by buckets (counting sort)
+	c->bucket = xmalloc((nb + 1) * sizeof*c->bucket);
+	memset(c->bucket, 0, (nb + 1) * sizeof*c->bucket);
+	for (int l = 0; l < nlabels; l++)
+		constellation_tuples(c, l, constellation_count_tuple, NULL);
+	for (int i = 0; i < nb; i++)
+		c->bucket[i+1] += c->bucket[i];
+	uint32_t *cursor = xmalloc(nb * sizeof*cursor);
+	memcpy(cursor, c->bucket, nb * sizeof*cursor);
+	c->npostings = n;
+	c->posting = xmalloc((n ? n : 1) * sizeof*c->posting);
+	for (int l = 0; l < nlabels; l++)
+		constellation_tuples(c, l, constellation_add_tuple, cursor);
+	free(cursor);
+}
+
+// API
+void constellation_index_free(struct constellation_index *c)
+{
+	free(c->start);
+	free(c->xy);
+	free(c->neighbors);
+	free(c->bucket);
+	free(c->posting);
+}
+
+// votes of the correspondences (point of the frame, dot), in a hash table
+struct constellation_pair {
+	uint64_t key;       // 1 + point * ndots + dot (0 = empty slot)
+	int label, count;
+};
+
+struct constellation_votes {
+	int bits, n;
+	struct constellation_pair *t;
+};
+
+static void constellation_votes_init(struct constellation_votes *V, int bits)
+{
+	V->bits = bits;
+	V->n = 0;
+	V->t = xmalloc(sizeof*V->t << bits);
+	memset(V->t, 0, sizeof*V->t << bits);
+}
+
+// slot of the correspondence (inserted without votes if it is new)
+static int constellation_votes_slot(struct constellation_votes *V,
+		uint64_t key, int label)
+{
+	uint32_t mask = (1u << V->bits) - 1;
+	uint32_t h = constellation_hash(key, V->bits);
+	while (V->t[h].key && V->t[h].key != key)
+		h = (h + 1) & mask;
+	if (V->t[h].key)
+		return h;
+	if (2 * (V->n + 1) > 1 << V->bits) { // rehash, to keep it half empty
+		struct constellation_votes W[1];
+		constellation_votes_init(W, V->bits + 1);
+		for (int i = 0; i < 1 << V->bits; i++)
+			if (V->t[i].key) {
+				uint32_t wmask = (1u << W->bits) - 1;
+				uint64_t wkey = V->t[i].key;
+				uint32_t w = constellation_hash(wkey, W->bits);
+				while (W->t[w].key)
+					w = (w + 1) & wmask;
+				W->t[w] = V->t[i];
+			}
+		W->n = V->n;
+		free(V->t);
+		*V = *W;
+		return constellation_votes_slot(V, key, label);
+	}
+	V->t[h].key = key;
+	V->t[h].label = label;
+	V->t[h].count = 0;
+	V->n += 1;
+	return h;
+}
+
+// add a vote to the correspondence
+// returns its number of votes
+static int constellation_votes_add(struct constellation_votes *V,
+		uint64_t key, int label)
+{
+	int h = constellation_votes_slot(V, key, label); // (may rehash)
+	return ++V->t[h].count;
+}
+
+// verify the constellation "l" by ransac on its voted correspondences (with
+// the quality of their number of votes), "dots" are the coordinates of the
+// "ndots" dots of all the constellations
+static void constellation_verify(struct constellation_match *out,
+		float *dots, int ndots, int l, float *xy,
+		struct constellation_votes *V,
+		float max_err, int min_inliers, uint64_t seed)
+{
+	float *data = xmalloc_float(4 * (out->ncorrespondences + 1));
+	float *quality = xmalloc_float(out->ncorrespondences + 1);
+	int m = 0;
+	for (int i = 0; i < 1 << V->bits; i++)
+	{
+		struct constellation_pair *P = V->t + i;
+		if (!P->key || P->label != l) continue;
+		int f = (P->key - 1) / ndots, r = (P->key - 1) % ndots;
+		data[4*m+0] = dots[2*r+0];
+		data[4*m+1] = dots[2*r+1];
+		data[4*m+2] = xy[2*f+0];
+		data[4*m+3] = xy[2*f+1];
+		quality[m] = P->count;
+		m += 1;
+	}
+
+	out->label = l;
+	out->ninliers = 0;
+	if (m >= 4) {
+		struct ransac_options o = {
+			.confidence = 0.999,
+			.min_trials = 10,
+			.seed = seed,
+			.sampler = SAMPLER_PROSAC,
+			.quality = quality,
+			.refine = homography_by_dlt,
+		};
+		out->ninliers = ransac_homography(NULL, out->H, data, m, 1000,
+				min_inliers, max_err, NULL, &o);
+	}
+	free(quality);
+	free(data);
+}
+
+// verify the constellations of the list "voted" with most votes in "bases",
+// up to "ncandidates" of them, until one is recognized (its match is then
+// copied to "out", whose label is otherwise left as it is)
+// "npairs" are the voted correspondences of each constellation, and the votes
+// of the verified ones are overwritten
+// returns the number of inliers (0 if no constellation was recognized)
+static int constellation_candidates(struct constellation_match *out,
+		int *voted, int nvoted, int *bases, int *npairs,
+		float *dots, int ndots, float *xy, struct constellation_votes *V,
+		int ncandidates, float max_err, int min_inliers, uint64_t seed)
+{
+	for (int t = 0; t < ncandidates && nvoted; t++)
+	{
+		int l = voted[0];
+		for (int i = 1; i < nvoted; i++)
+			if (bases[voted[i]] > bases[l])
+				l = voted[i];
+		if (bases[l] < 1)
+			break;
+		struct constellation_match m[1];
+		m->nvotes = bases[l];
+		m->ncorrespondences = npairs[l];
+		bases[l] = -1;
+		constellation_verify(m, dots, ndots, l, xy, V, max_err,
+				min_inliers, seed);
+		if (m->ninliers > 0) { // (a failed verification leaves no label)
+			*out = *m;
+			return m->ninliers;
+		}
+	}
+	return 0;
+}
+
+// a tuple of the frame found in the table: four dots of a constellation
+// matched to the triangle of the frame being looked up, and to its point "f"
+struct constellation_hit {
+	int label, r[4], f;
+};
+
+static int compare_constellation_hits(const void *aa, const void *bb)
+{
+	const struct constellation_hit *a = aa, *b = bb;
+	int x[5] = {a->label, a->r[0], a->r[1], a->r[2], a->f};
+	int y[5] = {b->label, b->r[0], b->r[1], b->r[2], b->f};
+	for (int j = 0; j < 5; j++)
+		if (x[j] != y[j])
+			return (x[j] > y[j]) - (x[j] < y[j]);
+	return 0;
+}
+
+// API: recognize one of the indexed constellations among the points "xy"
+// The tuples are formed with the "k" nearest neighbors of each point (k may
+// be larger than the "k" of the index, to make up for the points of the frame
+// that are not dots).  Each triangle of the frame is a basis: the tuples that
+// it forms with its fourth points vote for the (constellation, triangle) pairs
+// of their postings, and the pairs voted by at least two fourth points give
+// their correspondences (the random votes seldom agree).  The constellations
+// with most confirmed bases are verified, up to "ncandidates" of them, until
+// a homography with at least "min_inliers" inliers at distance less than
+// "max_err" is found.
+// returns the number of inliers (0 if no constellation was recognized)
+int constellation_matching(struct constellation_match *out,
+		struct constellation_index *c, float *xy, int n, int k,
+		int ncandidates, float max_err, int min_inliers, uint64_t seed)
+{
+	out->label = -1;
+	out->nvotes = out->ncorrespondences = out->ninliers = 0;
+	if (k > CONSTELLATION_MAX_K) k = CONSTELLATION_MAX_K;
+	if (n < 4 || k < 3 || c->nlabels < 1)
+		return 0;
+
+	int *nb = xmalloc_int(k * n);
+	constellation_neighbors(nb, xy, n, k);
+	int *bases = xmalloc_int(3 * c->nlabels), *npairs = bases + c->nlabels;
+	int *voted = npairs + c->nlabels, nvoted = 0; // constellations with votes
+	memset(bases, 0, 2 * c->nlabels * sizeof*bases);
+	struct constellation_votes V[1];
+	constellation_votes_init(V, 12);
+	uint64_t ndots = c->start[c->nlabels];
+	int cap = 64;
+	struct constellation_hit *hit = xmalloc(cap * sizeof*hit);
+	float tol = c->tol;
+	for (int p = 0; p < n; p++)
+	for (int a = 0; a < k; a++)
+	for (int b = a + 1; b < k; b++)
+	{
+		int *N = nb + k*p, v[3];
+		float q[5];
+		if (N[b] < 0 || !constellation_triangle(q, v, xy, p, N[a], N[b],
+					tol))
+			continue;
+
+		// look up the tuples of the triangle
+		int nhits = 0;
+		for (int j = 0; j < k; j++)
+		{
+			if (N[j] < 0 || j == a || j == b ||
+				!constellation_fourth_point(q, v, xy, N[j]))
+				continue;
+			int lo[5], hi[5];
+			for (int t = 0; t < 5; t++) // (q[2] is not quantized)
+			{
+				lo[t] = constellation_bin(q[t] - tol, t, tol);
+				hi[t] = constellation_bin(q[t] + tol, t, tol);
+			}
+			for (int i1 = lo[0]; i1 <= hi[0]; i1++)
+			for (int i2 = lo[1]; i2 <= hi[1]; i2++)
+			for (int iu = lo[3]; iu <= hi[3]; iu++)
+			for (int iw = lo[4]; iw <= hi[4]; iw++)
+			{
+				uint64_t h = constellation_mix(constellation_key(
+							q[2], i1, i2, iu, iw));
+				uint32_t *B = c->bucket + (h >> (64 - c->bits));
+				for (uint32_t i = B[0]; i < B[1]; i++)
+				{
+					struct constellation_posting *P =
+						c->posting + i;
+					if (P->check != (uint32_t)h)
+						continue;
+					if (nhits == cap) {
+						cap *= 2;
+						hit = realloc(hit, cap*sizeof*hit);
+						if (!hit) fail("constellation_"
+							"matching: out of memory");
+					}
+					hit[nhits].label = P->label;
+					constellation_tuple_dots(hit[nhits].r, c,
+							P->label, P->tuple);
+					hit[nhits].f = N[j];
+					nhits += 1;
+				}
+			}
+		}
+		if (nhits < 2)
+			continue;
+
+		// vote for the correspondences of the confirmed bases
+		qsort(hit, nhits, sizeof*hit, compare_constellation_hits);
+		for (int i = 0, i1; i < nhits; i = i1)
+		{
+			int support = 1;
+			for (i1 = i + 1; i1 < nhits && !memcmp(hit + i1, hit + i,
+						4 * sizeof(int)); i1++) // label, r[3]
+				support += hit[i1].f != hit[i1-1].f;
+			if (support < 2)
+				continue;
+			int l = hit[i].label;
+			if (!bases[l]++)
+				voted[nvoted++] = l;
+			for (int t = 0; t < 3; t++)
+				npairs[l] += 1 == constellation_votes_add(V,
+						1 + v[t]*ndots + hit[i].r[t], l);
+			for (int t = i; t < i1; t++)
+				npairs[l] += 1 == constellation_votes_add(V,
+						1 + hit[t].f*ndots + hit[t].r[3], l);
+		}
+	}
+
+	// verify the constellations with most confirmed bases
+	constellation_candidates(out, voted, nvoted, bases, npairs, c->xy,
+			ndots, xy, V, ncandidates, max_err, min_inliers, seed);
+
+	free(hit);
+	free(V->t);
+	free(bases);
+	free(nb);
+	return out->ninliers;
+}
+
+#endif//_CONSTELLATION_C
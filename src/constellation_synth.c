@@ -0,0 +1,63 @@
+// synthetic constellations and frames, for the benchmarks of the recognition
+
+#ifndef _CONSTELLATION_SYNTH_C
+#define _CONSTELLATION_SYNTH_C
+
+#include <math.h>
+#include <stdlib.h>
+
+static float random_float(void)
+{
+	return rand() / (RAND_MAX + 1.0);
+}
+
+// "nlabels" random constellations of "ndots" dots in [0,100)^2
+// ("start" has nlabels+1 entries and "xy" 2*nlabels*ndots)
+void synth_constellations(float *xy, int *start, int nlabels, int ndots)
+{
+	for (int l = 0; l <= nlabels; l++)
+		start[l] = l * ndots;
+	for (int i = 0; i < 2 * nlabels * ndots; i++)
+		xy[i] = 100 * random_float();
+}
+
+// random homography of a frame: a rotation, a zoom by 2 to 4, a translation
+// to the middle of the frame, and a perspective of coefficients in
+// [-persp/2, persp/2]
+void synth_homography(float H[9], float persp)
+{
+	float a = 6.3 * random_float(), s = 2 + 2 * random_float();
+	H[0] = s * cos(a); H[1] = -s * sin(a); H[2] = 400;
+	H[3] = s * sin(a); H[4] =  s * cos(a); H[5] = 300;
+	H[6] = persp * (random_float() - 0.5);
+	H[7] = persp * (random_float() - 0.5);
+	H[8] = 1;
+}
+
+// points of a 1000x800 frame: the "ndots" dots "xy" through H, 15% of them
+// missing and the others within 0.25 of their place, and "nclutter" random points
+// returns the number of points
+int synth_frame(float *out, float *xy, int ndots, float H[9], int nclutter)
+{
+	int n = 0;
+	for (int i = 0; i < ndots; i++)
+	{
+		if (random_float() < 0.15) continue;
+		float *p = xy + 2*i;
+		float w = H[6]*p[0] + H[7]*p[1] + H[8];
+		out[2*n+0] = (H[0]*p[0] + H[1]*p[1] + H[2]) / w
+			+ 0.5 * (random_float() - 0.5);
+		out[2*n+1] = (H[3]*p[0] + H[4]*p[1] + H[5]) / w
+			+ 0.5 * (random_float() - 0.5);
+		n += 1;
+	}
+	for (int i = 0; i < nclutter; i++)
+	{
+		out[2*n+0] = 1000 * random_float();
+		out[2*n+1] = 800 * random_float();
+		n += 1;
+	}
+	return n;
+}
+
+#endif//_CONSTELLATION_SYNTH_C
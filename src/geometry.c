@@ -1,3 +1,10 @@
+#ifndef _GEOMETRY_C
+#define _GEOMETRY_C
+
+#include <assert.h>
+#include <math.h>
+#include <stdbool.h>
+
 
 // compute the vector product of two vectors
 static void vector_product(double axb[3], double a[3], double b[3])
@@ -44,7 +51,7 @@ static bool cut_line_with_segment(double out[2], double line[3],
 }
 
 static bool cut_line_with_rectangle(double out_a[2], double out_b[2],
-		double line[3], double rec_from[2], double rec_to[4])
+		double line[3], double rec_from[2], double rec_to[2])
 {
 	// four vertices of the rectangle
 	double v[4][2] = {
@@ -91,6 +98,66 @@ float distance_of_point_to_straight_line(float *line, float *point, void *usr)
 	return fabs(e);
 }
 
+// instance of "ransac_error_evaluation_function", for the lines whose normal
+// vector (a,b) has unit norm (as those of the functions below)
+static inline float distance_of_point_to_unit_line(float *line, float *point,
+		void *usr)
+{
+	(void)usr;
+	return fabs(line[0]*point[0] + line[1]*point[1] + line[2]);
+}
+
+// instance of "ransac_batch_error_function"
+// (the line is normalized once, and the loop is vectorizable)
+void distance_of_points_to_straight_line(float *out_err, float *line,
+		float *soa, int ld, int n, void *usr)
+{
+	(void)usr;
+	float m = 1 / hypot(line[0], line[1]);
+	float a = line[0] * m;
+	float b = line[1] * m;
+	float c = line[2] * m;
+	float *x = soa;
+	float *y = soa + ld;
+	for (int i = 0; i < n; i++)
+		out_err[i] = fabs(a*x[i] + b*y[i] + c);
+}
+
+
+// instance of "ransac_model_refining_function"
+// (total least squares: the line through the centroid of the points, along
+// the principal axis of their covariance)
+int straight_line_by_total_least_squares(float *line, float *points, int n,
+		void *usr)
+{
+	(void)usr;
+	if (n < 2) return 0;
+	double mx = 0, my = 0;
+	for (int i = 0; i < n; i++)
+	{
+		mx += points[2*i+0];
+		my += points[2*i+1];
+	}
+	mx /= n;
+	my /= n;
+	double sxx = 0, sxy = 0, syy = 0;
+	for (int i = 0; i < n; i++)
+	{
+		double x = points[2*i+0] - mx;
+		double y = points[2*i+1] - my;
+		sxx += x * x;
+		sxy += x * y;
+		syy += y * y;
+	}
+	if (!(sxx + syy > 0)) return 0;
+	double t = atan2(2 * sxy, sxx - syy) / 2; // angle of the principal axis
+	double dx = -sin(t);
+	double dy = cos(t);
+	line[0] = dx;
+	line[1] = dy;
+	line[2] = -(dx*mx + dy*my);
+	return 1;
+}
 
 // instance of "ransac_model_generating_function"
 int straight_line_through_two_points(float *line, float *points, void *usr)
@@ -114,3 +181,379 @@ int straight_line_through_two_points(float *line, float *points, void *usr)
 	assert(hypot(e1, e2) < 0.001);
 	return 1;
 }
+
+
+
+// PLANAR TRANSFORMATIONS
+//
+// The data points of the models below are correspondences (x, y, x', y'),
+// and the error of a correspondence is the distance between the image of
+// (x,y) by the transformation and (x',y').  A homography is a 3x3 matrix
+// H[9] (by rows, normalized so that H[8]=1) and an affine map is a 2x3
+// matrix A[6], with x' = A[0]*x + A[1]*y + A[2] and y' = A[3]*x + A[4]*y + A[5].
+
+// solve the n*n linear system A*x=b by gaussian elimination with partial
+// pivoting (A and b are destroyed)
+// returns false if the system is singular
+static bool solve_linear_system(double *x, double *A, double *b, int n)
+{
+	for (int k = 0; k < n; k++)
+	{
+		int p = k;
+		for (int i = k + 1; i < n; i++)
+			if (fabs(A[i*n+k]) > fabs(A[p*n+k]))
+				p = i;
+		if (!(fabs(A[p*n+k]) > 1e-12))
+			return false;
+		if (p != k) {
+			for (int j = 0; j < n; j++)
+			{
+				double t = A[k*n+j]; A[k*n+j] = A[p*n+j]; A[p*n+j] = t;
+			}
+			double t = b[k]; b[k] = b[p]; b[p] = t;
+		}
+		for (int i = k + 1; i < n; i++)
+		{
+			double f = A[i*n+k] / A[k*n+k];
+			for (int j = k; j < n; j++)
+				A[i*n+j] -= f * A[k*n+j];
+			b[i] -= f * b[k];
+		}
+	}
+	for (int i = n - 1; i >= 0; i--)
+	{
+		double r = b[i];
+		for (int j = i + 1; j < n; j++)
+			r -= A[i*n+j] * x[j];
+		x[i] = r / A[i*n+i];
+	}
+	return true;
+}
+
+// eigenvector of the smallest eigenvalue of the n*n symmetric matrix S, by
+// cyclic Jacobi rotations (S is destroyed)
+static void smallest_eigenvector(double *out_v, double *S, int n)
+{
+	double V[n*n];
+	for (int i = 0; i < n*n; i++)
+		V[i] = i % (n + 1) ? 0 : 1;
+	for (int sweep = 0; sweep < 50; sweep++)
+	{
+		double off = 0, diag = 0;
+		for (int i = 0; i < n; i++)
+		for (int j = 0; j < n; j++)
+			if (i != j) off += S[i*n+j] * S[i*n+j];
+			else diag += S[i*n+j] * S[i*n+j];
+		if (!(off > 1e-24 * diag))
+			break;
+		for (int p = 0; p < n; p++)
+		for (int q = p + 1; q < n; q++)
+		{
+			if (!S[p*n+q]) continue;
+			double t = (S[q*n+q] - S[p*n+p]) / (2 * S[p*n+q]);
+			t = (t >= 0 ? 1 : -1) / (fabs(t) + sqrt(1 + t*t));
+			double c = 1 / sqrt(1 + t*t), s = t * c;
+			for (int k = 0; k < n; k++) // S = S * J
+			{
+				double a = S[k*n+p], b = S[k*n+q];
+				S[k*n+p] = c*a - s*b;
+				S[k*n+q] = s*a + c*b;
+			}
+			for (int k = 0; k < n; k++) // S = J' * S
+			{
+				double a = S[p*n+k], b = S[q*n+k];
+				S[p*n+k] = c*a - s*b;
+				S[q*n+k] = s*a + c*b;
+			}
+			for (int k = 0; k < n; k++) // V = V * J
+			{
+				double a = V[k*n+p], b = V[k*n+q];
+				V[k*n+p] = c*a - s*b;
+				V[k*n+q] = s*a + c*b;
+			}
+		}
+	}
+	int m = 0;
+	for (int i = 1; i < n; i++)
+		if (S[i*n+i] < S[m*n+m])
+			m = i;
+	for (int i = 0; i < n; i++)
+		out_v[i] = V[i*n+m];
+}
+
+// similarity that sends the centroid of the points (at offset "o" inside
+// each correspondence) to the origin and their mean distance to sqrt(2)
+// (Hartley's normalization), given as (scale, center x, center y)
+static void normalization_of_points(double T[3], float *data, int n, int o)
+{
+	double mx = 0, my = 0, d = 0;
+	for (int i = 0; i < n; i++)
+	{
+		mx += data[4*i+o+0];
+		my += data[4*i+o+1];
+	}
+	mx /= n;
+	my /= n;
+	for (int i = 0; i < n; i++)
+		d += hypot(data[4*i+o+0] - mx, data[4*i+o+1] - my);
+	d /= n;
+	T[0] = d > 0 ? sqrt(2) / d : 1;
+	T[1] = mx;
+	T[2] = my;
+}
+
+// H = inverse(T') * Hn * T, normalized so that H[8]=1
+// returns false if H[8] is zero or the result is not finite
+static bool denormalize_homography(float H[9], double Hn[9],
+		double T[3], double Tp[3])
+{
+	// Hn * T, where T = [s 0 -s*mx; 0 s -s*my; 0 0 1]
+	double M[9];
+	for (int i = 0; i < 3; i++)
+	{
+		M[3*i+0] = Hn[3*i+0] * T[0];
+		M[3*i+1] = Hn[3*i+1] * T[0];
+		M[3*i+2] = Hn[3*i+2] - T[0] * (Hn[3*i+0]*T[1] + Hn[3*i+1]*T[2]);
+	}
+	// inverse(T') * M, where inverse(T') = [1/s' 0 mx'; 0 1/s' my'; 0 0 1]
+	double R[9];
+	for (int j = 0; j < 3; j++)
+	{
+		R[0+j] = M[0+j] / Tp[0] + Tp[1] * M[6+j];
+		R[3+j] = M[3+j] / Tp[0] + Tp[2] * M[6+j];
+		R[6+j] = M[6+j];
+	}
+	if (!(fabs(R[8]) > 1e-12))
+		return false;
+	for (int i = 0; i < 9; i++)
+	{
+		H[i] = R[i] / R[8];
+		if (!isfinite(H[i]))
+			return false;
+	}
+	return true;
+}
+
+// signed area of the triangle of points (at offset "o") i, j, k
+static double triangle_area(float *data, int o, int i, int j, int k)
+{
+	float *a = data + 4*i + o, *b = data + 4*j + o, *c = data + 4*k + o;
+	return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+// whether the triangles of the sample are not degenerate, and have the same
+// orientation in the two images (all of them, or the opposite for all of
+// them), so that no point of the sample crosses the line of two others
+static bool sample_is_consistent(float *data, int n)
+{
+	int sign = 0;
+	for (int i = 0; i < n; i++)
+	for (int j = i + 1; j < n; j++)
+	for (int k = j + 1; k < n; k++)
+	{
+		double a = triangle_area(data, 0, i, j, k);
+		double b = triangle_area(data, 2, i, j, k);
+		double la = hypot(data[4*j+0] - data[4*i+0],
+				data[4*j+1] - data[4*i+1]);
+		double lb = hypot(data[4*j+2] - data[4*i+2],
+				data[4*j+3] - data[4*i+3]);
+		if (!(fabs(a) > 1e-3 * la * la && fabs(b) > 1e-3 * lb * lb))
+			return false; // (nearly) collinear
+		int s = (a > 0) == (b > 0) ? 1 : -1;
+		if (sign && s != sign)
+			return false;
+		sign = s;
+	}
+	return true;
+}
+
+// instance of "ransac_error_evaluation_function"
+float homography_transfer_error(float *H, float *pair, void *usr)
+{
+	(void)usr;
+	float x = pair[0], y = pair[1];
+	float w = H[6]*x + H[7]*y + H[8];
+	if (!(fabs(w) > 1e-8))
+		return INFINITY;
+	float u = (H[0]*x + H[1]*y + H[2]) / w;
+	float v = (H[3]*x + H[4]*y + H[5]) / w;
+	return hypot(u - pair[2], v - pair[3]);
+}
+
+// instance of "ransac_batch_error_function"
+void homography_transfer_errors(float *out_err, float *H,
+		float *soa, int ld, int n, void *usr)
+{
+	(void)usr;
+	float *x = soa, *y = soa + ld, *xp = soa + 2*ld, *yp = soa + 3*ld;
+	for (int i = 0; i < n; i++)
+	{
+		float w = H[6]*x[i] + H[7]*y[i] + H[8];
+		float u = (H[0]*x[i] + H[1]*y[i] + H[2]) / w - xp[i];
+		float v = (H[3]*x[i] + H[4]*y[i] + H[5]) / w - yp[i];
+		float e = sqrt(u*u + v*v);
+		out_err[i] = fabs(w) > 1e-8 && e == e ? e : INFINITY;
+	}
+}
+
+// instance of "ransac_model_generating_function"
+// (normalized DLT from 4 correspondences, with h33 = 1)
+int homography_from_four_pairs(float *H, float *pairs, void *usr)
+{
+	(void)usr;
+	if (!sample_is_consistent(pairs, 4))
+		return 0;
+	double T[3], Tp[3];
+	normalization_of_points(T, pairs, 4, 0);
+	normalization_of_points(Tp, pairs, 4, 2);
+	double A[64], b[8], h[9];
+	for (int i = 0; i < 4; i++)
+	{
+		double x = T[0] * (pairs[4*i+0] - T[1]);
+		double y = T[0] * (pairs[4*i+1] - T[2]);
+		double u = Tp[0] * (pairs[4*i+2] - Tp[1]);
+		double v = Tp[0] * (pairs[4*i+3] - Tp[2]);
+		double r0[8] = {x, y, 1, 0, 0, 0, -u*x, -u*y};
+		double r1[8] = {0, 0, 0, x, y, 1, -v*x, -v*y};
+		for (int j = 0; j < 8; j++)
+		{
+			A[(2*i+0)*8+j] = r0[j];
+			A[(2*i+1)*8+j] = r1[j];
+		}
+		b[2*i+0] = u;
+		b[2*i+1] = v;
+	}
+	if (!solve_linear_system(h, A, b, 8))
+		return 0;
+	h[8] = 1;
+	return denormalize_homography(H, h, T, Tp);
+}
+
+// normalized DLT by weighted least squares on n >= 4 correspondences, each
+// one with the weight w[i] (or 1 if "w" is NULL)
+// returns false if there are not enough correspondences with positive weight
+bool homography_by_weighted_dlt(float *H, float *pairs, float *w, int n)
+{
+	int m = 0;
+	for (int i = 0; i < n; i++)
+		m += !w || w[i] > 0;
+	if (m < 4) return false;
+	double T[3], Tp[3];
+	normalization_of_points(T, pairs, n, 0);
+	normalization_of_points(Tp, pairs, n, 2);
+	double S[81] = {0}, h[9];
+	for (int i = 0; i < n; i++)
+	{
+		double x = T[0] * (pairs[4*i+0] - T[1]);
+		double y = T[0] * (pairs[4*i+1] - T[2]);
+		double u = Tp[0] * (pairs[4*i+2] - Tp[1]);
+		double v = Tp[0] * (pairs[4*i+3] - Tp[2]);
+		double r0[9] = {x, y, 1, 0, 0, 0, -u*x, -u*y, -u};
+		double r1[9] = {0, 0, 0, x, y, 1, -v*x, -v*y, -v};
+		double wi = w ? w[i] : 1;
+		for (int j = 0; j < 9; j++)
+		for (int k = 0; k < 9; k++)
+			S[9*j+k] += wi * (r0[j]*r0[k] + r1[j]*r1[k]);
+	}
+	smallest_eigenvector(h, S, 9);
+	return denormalize_homography(H, h, T, Tp);
+}
+
+// instance of "ransac_model_refining_function"
+// (normalized DLT by least squares on n >= 4 correspondences)
+int homography_by_dlt(float *H, float *pairs, int n, void *usr)
+{
+	(void)usr;
+	return homography_by_weighted_dlt(H, pairs, NULL, n);
+}
+
+// instance of "ransac_model_accepting_function"
+// (rejects the homographies that flip the orientation around the origin, or
+// whose linear part there is nearly singular)
+bool homography_is_acceptable(float *H, void *usr)
+{
+	(void)usr;
+	double a = H[0] - H[6]*H[2], b = H[1] - H[7]*H[2];
+	double c = H[3] - H[6]*H[5], d = H[4] - H[7]*H[5];
+	double det = a*d - b*c;
+	double f = a*a + b*b + c*c + d*d; // sum of squared singular values
+	return det > 0 && det > 0.01 * f;
+}
+
+// instance of "ransac_error_evaluation_function"
+float affine_transfer_error(float *A, float *pair, void *usr)
+{
+	(void)usr;
+	float u = A[0]*pair[0] + A[1]*pair[1] + A[2] - pair[2];
+	float v = A[3]*pair[0] + A[4]*pair[1] + A[5] - pair[3];
+	return hypot(u, v);
+}
+
+// instance of "ransac_batch_error_function"
+void affine_transfer_errors(float *out_err, float *A,
+		float *soa, int ld, int n, void *usr)
+{
+	(void)usr;
+	float *x = soa, *y = soa + ld, *xp = soa + 2*ld, *yp = soa + 3*ld;
+	for (int i = 0; i < n; i++)
+	{
+		float u = A[0]*x[i] + A[1]*y[i] + A[2] - xp[i];
+		float v = A[3]*x[i] + A[4]*y[i] + A[5] - yp[i];
+		out_err[i] = sqrt(u*u + v*v);
+	}
+}
+
+// instance of "ransac_model_refining_function"
+// (least squares on n >= 3 correspondences, with centered coordinates)
+int affine_by_least_squares(float *A, float *pairs, int n, void *usr)
+{
+	(void)usr;
+	if (n < 3) return 0;
+	double mx = 0, my = 0, mu = 0, mv = 0;
+	for (int i = 0; i < n; i++)
+	{
+		mx += pairs[4*i+0]; my += pairs[4*i+1];
+		mu += pairs[4*i+2]; mv += pairs[4*i+3];
+	}
+	mx /= n; my /= n; mu /= n; mv /= n;
+	double sxx = 0, sxy = 0, syy = 0, sxu = 0, syu = 0, sxv = 0, syv = 0;
+	for (int i = 0; i < n; i++)
+	{
+		double x = pairs[4*i+0] - mx, y = pairs[4*i+1] - my;
+		double u = pairs[4*i+2] - mu, v = pairs[4*i+3] - mv;
+		sxx += x*x; sxy += x*y; syy += y*y;
+		sxu += x*u; syu += y*u; sxv += x*v; syv += y*v;
+	}
+	double det = sxx*syy - sxy*sxy;
+	if (!(det > 1e-9 * (sxx + syy) * (sxx + syy)))
+		return 0;
+	A[0] = ( syy*sxu - sxy*syu) / det;
+	A[1] = (-sxy*sxu + sxx*syu) / det;
+	A[3] = ( syy*sxv - sxy*syv) / det;
+	A[4] = (-sxy*sxv + sxx*syv) / det;
+	A[2] = mu - A[0]*mx - A[1]*my;
+	A[5] = mv - A[3]*mx - A[4]*my;
+	return 1;
+}
+
+// instance of "ransac_model_generating_function"
+// (the affine map of 3 correspondences)
+int affine_from_three_pairs(float *A, float *pairs, void *usr)
+{
+	if (!sample_is_consistent(pairs, 3))
+		return 0;
+	return affine_by_least_squares(A, pairs, 3, usr);
+}
+
+// instance of "ransac_model_accepting_function"
+// (rejects the affine maps that flip the orientation, or are nearly
+// singular)
+bool affine_is_acceptable(float *A, void *usr)
+{
+	(void)usr;
+	double det = A[0]*A[4] - A[1]*A[3];
+	double f = A[0]*A[0] + A[1]*A[1] + A[3]*A[3] + A[4]*A[4];
+	return det > 0 && det > 0.01 * f;
+}
+
+#endif//_GEOMETRY_C
@@ -0,0 +1,57 @@
+// compare the running times of the keypoint detection engines
+#include "harressian.c"
+#include "boxhessian.c"
+#include "iio.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "pickopt.c"
+#include "seconds.c"
+
+typedef int (*keypoint_engine)(float*,int,float*,int,int,float,float,float);
+
+static void bench_engine(char *name, keypoint_engine f, int nrep,
+		float *x, int w, int h, int maxpoints,
+		float sigma, float kappa, float tau)
+{
+	float *y = xmalloc_float(4 * maxpoints);
+	int n = 0;
+	f(y, maxpoints, x, w, h, sigma, kappa, tau); // warm-up run
+	double t = seconds();
+	for (int i = 0; i < nrep; i++)
+		n = f(y, maxpoints, x, w, h, sigma, kappa, tau);
+	t = (seconds() - t) / nrep;
+	printf("%-10s %6d points %10.3f ms/frame %8.1f Hz\n",
+			name, n, 1000 * t, 1 / t);
+	free(y);
+}
+
+int main(int c, char *v[])
+{
+	// extract named options
+	int maxpoints = atoi(pick_option(&c, &v, "m", "2000"));
+	int nrep = atoi(pick_option(&c, &v, "r", "20"));
+	float param_s = atof(pick_option(&c, &v, "s", "1.0"));
+	float param_k = atof(pick_option(&c, &v, "k", "0.24"));
+	float param_t = atof(pick_option(&c, &v, "t", "30"));
+
+	// process remaining positional arguments
+	if (c != 2)
+		return fprintf(stderr, "usage:\n\t%s in.png\n", *v);
+	char *filename_in = v[1];
+
+	// read input image (as gray)
+	int w, h;
+	float *x = iio_read_image_float(filename_in, &w, &h);
+	printf("%s: %dx%d, %d repetitions\n", filename_in, w, h, nrep);
+
+	// run the engines
+	bench_engine("pyramid", harressian, nrep, x, w, h, maxpoints,
+			param_s, param_k, param_t);
+	bench_engine("box", boxhessian, nrep, x, w, h, maxpoints,
+			param_s, param_k, param_t);
+
+	// cleanup and exit
+	free(x);
+	return 0;
+}
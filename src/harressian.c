@@ -1,12 +1,17 @@
 // implementation of the "harris hessian" keypoint detector
 
+#ifndef _HARRESSIAN_C
+#define _HARRESSIAN_C
+
 #include <assert.h>
 #include <math.h>
 #include <string.h>
 #include "xmalloc.c"
 
-// ~ 9*w*h multiplications
-void poor_man_gaussian_filter(float *out, float *in, int w, int h, float sigma)
+// filter only the pixels of the rectangle [i0,i1) x [j0,j1)
+// (the pixels at the border of the image are not touched)
+void poor_man_gaussian_filter_rect(float *out, float *in, int w, int h,
+		float sigma, int i0, int j0, int i1, int j1)
 {
 	// build 3x3 approximation of gaussian kernel
 	float k0 = 1;
@@ -16,8 +21,8 @@ void poor_man_gaussian_filter(float *out, float *in, int w, int h, float sigma)
 	float k[3][3] = {{k2, k1, k2}, {k1, k0, k1}, {k2, k1, k2}};
 
 	// hand-made convolution
-	for (int j = 1; j < h - 1; j ++)
-	for (int i = 1; i < w - 1; i ++)
+	for (int j = fmax(1, j0); j < fmin(h - 1, j1); j ++)
+	for (int i = fmax(1, i0); i < fmin(w - 1, i1); i ++)
 	{
 		float ax = 0;
 		for (int dj = 0; dj < 3; dj++)
@@ -31,6 +36,12 @@ void poor_man_gaussian_filter(float *out, float *in, int w, int h, float sigma)
 	}
 }
 
+// ~ 9*w*h multiplications
+void poor_man_gaussian_filter(float *out, float *in, int w, int h, float sigma)
+{
+	poor_man_gaussian_filter_rect(out, in, w, h, sigma, 0, 0, w, h);
+}
+
 void rich_man_gaussian_filter(float *out, float *in, int w, int h, float sigma)
 {
 	// build 5x5 approximation of gaussian kernel
@@ -204,6 +215,7 @@ static void fill_pyramid(struct gray_image_pyramid *p, float *x, int w, int h,
 			if (i + 1 >= MAX_LEVELS) break;
 			p->w[i] = ceil(p->w[i-1]/2);
 			p->h[i] = ceil(p->h[i-1]/2);
+			if (p->w[i] < 1 || p->h[i] < 1) break;
 			if (p->w[i] <= 1 && p->h[i] <= 1) break;
 			p->x[i] = xmalloc_float(p->w[i] * p->h[i]);
 			p->n = i;
@@ -224,9 +236,11 @@ static void fill_pyramid(struct gray_image_pyramid *p, float *x, int w, int h,
 		if (i + 1 >= MAX_LEVELS) break;
 		p->w[i] = ceil(p->w[i-1]/2);
 		p->h[i] = ceil(p->h[i-1]/2);
+		if (p->w[i] < 1 || p->h[i] < 1) break;
 		if (p->w[i] <= 1 && p->h[i] <= 1) break;
 		p->x[i] = xmalloc_float(p->w[i] * p->h[i]);
 		float *tmp1 = xmalloc_float(p->w[i-1] * p->h[i-1]);
+		memcpy(tmp1, p->x[i-1], p->w[i-1] * p->h[i-1] * sizeof*tmp1);
 		//float *tmp2 = xmalloc_float(p->w[i-1] * p->h[i-1]);
 		//float *tmp3 = xmalloc_float(p->w[i-1] * p->h[i-1]);
 		poor_man_gaussian_filter(tmp1,p->x[i-1],p->w[i-1],p->h[i-1], S);
@@ -319,15 +333,16 @@ static float parabolic_minimum(float p, float q, float r)
 //}
 
 
-// ~ 9*w*h multiplications
-int harressian_nogauss(float *out_xyt, int max_npoints,
-		float *x, int w, int h, float kappa, float tau)
+// single-scale detection restricted to the rectangle [i0,i1) x [j0,j1)
+int harressian_nogauss_rect(float *out_xyt, int max_npoints,
+		float *x, int w, int h, float kappa, float tau,
+		int i0, int j0, int i1, int j1)
 {
 	float sign = kappa > 0 ? 1 : -1;
 	kappa = fabs(kappa);
 	int n = 0;
-	for (int j = 2; j < h - 2; j++)
-	for (int i = 2; i < w - 2; i++)
+	for (int j = fmax(2, j0); j < fmin(h - 2, j1); j++)
+	for (int i = fmax(2, i0); i < fmin(w - 2, i1); i++)
 	{
 		// Vmm V0m Vpm
 		// Vm0 V00 Vp0
@@ -372,6 +387,14 @@ done:
 	return n;
 }
 
+// ~ 9*w*h multiplications
+int harressian_nogauss(float *out_xyt, int max_npoints,
+		float *x, int w, int h, float kappa, float tau)
+{
+	return harressian_nogauss_rect(out_xyt, max_npoints, x, w, h,
+			kappa, tau, 0, 0, w, h);
+}
+
 //static float evaluate_bilinear_cell(float a, float b, float c, float d,
 //							float x, float y)
 //{
@@ -532,59 +555,104 @@ void fill_pyramid_level(float *inout, int w, int h,
 	free(sx);
 }
 
-int harressian_ms(float *out_xyst, int max_npoints, float *x, int w, int h,
-		float sigma, float kappa, float tau)
+// scale of the pyramid filter
+#define HARRESSIAN_PYRAMID_SIGMA (2.8/2)
+
+// apply nongaussian harressian at one level of the pyramid, inside the
+// rectangle [i0,i1) x [j0,j1) of this level, and keep only the points that
+// are well-localized in scale
+// xyst = (x position, y position, scale, score), in full-resolution units
+int harressian_pyramid_level(float *out_xyst, int max_npoints,
+		struct gray_image_pyramid *p, int l, float kappa, float tau,
+		int i0, int j0, int i1, int j1)
 {
-	// filter input image
+	float *tab_xyt = xmalloc_float(3 * (max_npoints + 1));
+	int n_l = harressian_nogauss_rect(tab_xyt, max_npoints + 1,
+			p->x[l], p->w[l], p->h[l], kappa, tau, i0, j0, i1, j1);
+	float factor = 1 << l;
+	int n = 0;
+	for (int i = 0; i < n_l; i++)
+	{
+		if (n >= max_npoints) break;
+		float x = tab_xyt[3*i+0];
+		float y = tab_xyt[3*i+1];
+
+		// first-order scale localization
+		float A = fabs(pyramidal_laplacian(p, x/2, y/2, l+1));
+		float B = fabs(pyramidal_laplacian(p, x, y, l));
+		float C = fabs(pyramidal_laplacian(p, x*2, y*2, l-1));
+		if (l > 0 && C > B) continue;
+		if (A > B) continue;
+		//if (l > 0 && A > B) continue;
+		//if (A > B || C > B) continue;
+		float factor_scaling = 0;//parabolic_minimum(-A, -B, -C);
+		float new_factor = factor * (3*factor_scaling + 5) / 4;
+		//fprintf(stderr, "(%g %g %g) ", factor, factor_scaling, new_factor);
+
+		out_xyst[4*n+0] = factor * x;
+		out_xyst[4*n+1] = factor * y;
+		out_xyst[4*n+2] = new_factor;
+		out_xyst[4*n+3] = tab_xyt[3*i+2];
+		n++;
+	}
+	assert(n <= max_npoints);
+	free(tab_xyt);
+	return n;
+}
+
+// type of the function that receives the keypoints of each level as soon as
+// they are available (shall return non-zero to stop the detection)
+typedef int (harressian_level_callback)(
+		float *xyst,       // keypoints of this level
+		int n,             // number of keypoints of this level
+		int level,         // octave (levels arrive from coarse to fine)
+		void *usr
+		);
+
+// streaming version of harressian_ms: the points are written on the output
+// array level by level, and each level is passed to the callback "f" right
+// after it is computed, so that the caller can start processing the coarse
+// points while the finer levels are still being computed
+// (note: the multi-scale exclusion of "harressian" is not applied)
+int harressian_ms_stream(float *out_xyst, int max_npoints,
+		float *x, int w, int h, float sigma, float kappa, float tau,
+		harressian_level_callback *f, void *usr)
+{
+	// filter input image (the borders are kept unfiltered)
 	float *sx = xmalloc_float(w * h);
+	memcpy(sx, x, w*h*sizeof*x);
 	poor_man_gaussian_filter(sx, x, w, h, sigma);
 
 	// create image pyramid
 	struct gray_image_pyramid p[1];
-	fill_pyramid(p, sx, w, h, 2.8/2);
-	float *tab_xyt = xmalloc_float(3 * max_npoints);
+	fill_pyramid(p, sx, w, h, HARRESSIAN_PYRAMID_SIGMA);
 
 	// apply nongaussian harressian at each level of the pyramid
 	int n = 0;
 	for (int l = p->n - 1; l >= 0; l--)
 	{
-		int n_l = harressian_nogauss(tab_xyt, max_npoints - n,
-				p->x[l], p->w[l], p->h[l], kappa, tau);
-		float factor = 1 << l;
-		for (int i = 0; i < n_l; i++)
-		{
-			if (n >= max_npoints) break;
-			float x = tab_xyt[3*i+0];
-			float y = tab_xyt[3*i+1];
-
-			// first-order scale localization
-			float A = fabs(pyramidal_laplacian(p, x/2, y/2, l+1));
-			float B = fabs(pyramidal_laplacian(p, x, y, l));
-			float C = fabs(pyramidal_laplacian(p, x*2, y*2, l-1));
-			if (l > 0 && C > B) continue;
-			if (A > B) continue;
-			//if (l > 0 && A > B) continue;
-			//if (A > B || C > B) continue;
-			float factor_scaling = 0;//parabolic_minimum(-A, -B, -C);
-			float new_factor = factor * (3*factor_scaling + 5) / 4;
-			//fprintf(stderr, "(%g %g %g) ", factor, factor_scaling, new_factor);
-
-			out_xyst[4*n+0] = factor * x;
-			out_xyst[4*n+1] = factor * y;
-			out_xyst[4*n+2] = new_factor;
-			out_xyst[4*n+3] = tab_xyt[3*i+2];
-			n++;
-		}
+		float *xyst_l = out_xyst + 4*n;
+		int n_l = harressian_pyramid_level(xyst_l, max_npoints - n,
+				p, l, kappa, tau, 0, 0, p->w[l], p->h[l]);
+		n += n_l;
+		if (f && f(xyst_l, n_l, l, usr))
+			break;
 	}
 	assert(n <= max_npoints);
 
 	// cleanup and exit
-	free(tab_xyt);
 	free_pyramid(p);
 	free(sx);
 	return n;
 }
 
+int harressian_ms(float *out_xyst, int max_npoints, float *x, int w, int h,
+		float sigma, float kappa, float tau)
+{
+	return harressian_ms_stream(out_xyst, max_npoints, x, w, h,
+			sigma, kappa, tau, NULL, NULL);
+}
+
 bool point_is_redundant(float *a, float *b)
 {
 	float ax = a[0]; float ay = a[1]; float as = a[2];
@@ -623,3 +691,128 @@ int harressian(float *out_xyst, int max_npoints, float *x, int w, int h,
 	return r;
 }
 
+// comparison function for sorting points by decreasing scale
+static int compare_xyst_by_decreasing_scale(const void *aa, const void *bb)
+{
+	const float *a = (const float *)aa;
+	const float *b = (const float *)bb;
+	return (a[2] < b[2]) - (a[2] > b[2]);
+}
+
+#define HARRESSIAN_WINDOW_TILE 32
+
+// label the 4-connected components of the marked tiles (labels from 1)
+// and fill their bounding boxes (in tiles, inclusive bounds)
+static int label_tile_components(int *out_label, int *out_bbox,
+		uint8_t *m, int tw, int th)
+{
+	int *stack = xmalloc_int(tw * th);
+	int nc = 0;
+	for (int i = 0; i < tw * th; i++)
+		out_label[i] = 0;
+	for (int i = 0; i < tw * th; i++)
+	if (m[i] && !out_label[i])
+	{
+		int *bb = out_bbox + 4*nc;
+		nc += 1;
+		bb[0] = bb[2] = i % tw;
+		bb[1] = bb[3] = i / tw;
+		int ns = 0;
+		stack[ns++] = i;
+		out_label[i] = nc;
+		while (ns)
+		{
+			int q = stack[--ns];
+			int a = q % tw, b = q / tw;
+			bb[0] = fmin(bb[0], a); bb[2] = fmax(bb[2], a);
+			bb[1] = fmin(bb[1], b); bb[3] = fmax(bb[3], b);
+			int nq[4] = {q - 1, q + 1, q - tw, q + tw};
+			bool ok[4] = {a > 0, a + 1 < tw, b > 0, b + 1 < th};
+			for (int k = 0; k < 4; k++)
+				if (ok[k] && m[nq[k]] && !out_label[nq[k]])
+				{
+					out_label[nq[k]] = nc;
+					stack[ns++] = nq[k];
+				}
+		}
+	}
+	free(stack);
+	return nc;
+}
+
+// harressian restricted to a set of windows (x0, y0, x1, y1) of the image
+//
+// The windows are rounded to tiles, and each connected group of tiles is
+// processed on the crop of its bounding box extended by "halo" pixels, so
+// that the coarse levels see enough context.  Only the points that fall on
+// the tiles of the group are kept.
+int harressian_windows(float *out_xyst, int max_npoints,
+		float *x, int w, int h, float sigma, float kappa, float tau,
+		int *rects, int nrects, int halo)
+{
+	// mark the tiles covered by the windows
+	int T = HARRESSIAN_WINDOW_TILE;
+	int tw = (w + T - 1) / T;
+	int th = (h + T - 1) / T;
+	uint8_t *m = xmalloc_uint8(tw * th);
+	memset(m, 0, tw * th);
+	for (int k = 0; k < nrects; k++)
+	{
+		int *r = rects + 4*k;
+		int a0 = fmax(0, r[0] / T), a1 = fmin(tw - 1, r[2] / T);
+		int b0 = fmax(0, r[1] / T), b1 = fmin(th - 1, r[3] / T);
+		for (int b = b0; b <= b1; b++)
+		for (int a = a0; a <= a1; a++)
+			m[b*tw+a] = 1;
+	}
+	int *label = xmalloc_int(tw * th);
+	int *bbox = xmalloc_int(4 * tw * th);
+	int ncomp = label_tile_components(label, bbox, m, tw, th);
+
+	// run the detector on the crop of each group of tiles
+	float *tmp_xyst = xmalloc_float(4 * max_npoints);
+	float *crop_xyst = xmalloc_float(4 * max_npoints);
+	int n = 0;
+	for (int c = 0; c < ncomp; c++)
+	{
+		int *bb = bbox + 4*c;
+		int i0 = fmax(0, bb[0] * T - halo);
+		int j0 = fmax(0, bb[1] * T - halo);
+		int i1 = fmin(w, (bb[2] + 1) * T + halo);
+		int j1 = fmin(h, (bb[3] + 1) * T + halo);
+		int cw = i1 - i0, ch = j1 - j0;
+		float *crop = xmalloc_float(cw * ch);
+		for (int j = 0; j < ch; j++)
+		for (int i = 0; i < cw; i++)
+			crop[j*cw+i] = x[(j+j0)*w+i+i0];
+		int nc = harressian_ms(crop_xyst, max_npoints, crop, cw, ch,
+				sigma, kappa, tau);
+		for (int i = 0; i < nc && n < max_npoints; i++)
+		{
+			float *X = crop_xyst + 4*i;
+			float px = X[0] + i0;
+			float py = X[1] + j0;
+			int a = px / T, b = py / T;
+			if (px < 0 || py < 0 || a >= tw || b >= th) continue;
+			if (label[b*tw+a] != c + 1) continue;
+			tmp_xyst[4*n+0] = px;
+			tmp_xyst[4*n+1] = py;
+			tmp_xyst[4*n+2] = X[2];
+			tmp_xyst[4*n+3] = X[3];
+			n += 1;
+		}
+		free(crop);
+	}
+
+	// multi-scale exclusion, as in "harressian"
+	qsort(tmp_xyst, n, 4*sizeof*tmp_xyst, compare_xyst_by_decreasing_scale);
+	int r = remove_redundant_points(out_xyst, tmp_xyst, n);
+	free(crop_xyst);
+	free(tmp_xyst);
+	free(bbox);
+	free(label);
+	free(m);
+	return r;
+}
+
+#endif//_HARRESSIAN_C
@@ -1,10 +1,26 @@
 #include "harressian.c"
+#include "boxhessian.c"
 #include "iio.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include "pickopt.c"
 #include "xfopen.c"
+
+// print the points of each level as soon as they are computed
+static int print_level(float *xyst, int n, int level, void *usr)
+{
+	FILE *f = usr;
+	for (int i = 0; i < n; i++)
+	{
+		float *z = xyst + 4*i;
+		fprintf(f, "%g %g %g %g\n", z[0], z[1], z[2], z[3]);
+	}
+	fflush(f);
+	(void)level;
+	return 0;
+}
+
 int main(int c, char *v[])
 {
 	// extract named options
@@ -12,6 +28,11 @@ int main(int c, char *v[])
 	float param_s = atof(pick_option(&c, &v, "s", "1.0"));
 	float param_k = atof(pick_option(&c, &v, "k", "0.24"));
 	float param_t = atof(pick_option(&c, &v, "t", "30"));
+	char *param_e = pick_option(&c, &v, "e", "pyramid"); // or "box"
+	bool stream = pick_option(&c, &v, "stream", NULL); // raw, level by level
+	if (stream && strcmp(param_e, "pyramid"))
+		fail("-stream works only with the pyramid engine (not \"%s\")",
+				param_e);
 
 	// process remaining positional arguments
 	if (c > 3 || (c == 2 && !strcmp(v[1], "-h")))
@@ -26,8 +47,25 @@ int main(int c, char *v[])
 	// allocate space for output table
 	float *y = malloc(maxpoints * 4 * sizeof*y);
 
+	// stream the raw points of each level (without multi-scale exclusion)
+	if (stream) {
+		FILE *f = xfopen(filename_out, "w");
+		harressian_ms_stream(y, maxpoints, x, w, h,
+				param_s, param_k, param_t, print_level, f);
+		xfclose(f);
+		free(x);
+		free(y);
+		return 0;
+	}
+
 	// run the algorithm
-	int n = harressian(y, maxpoints, x, w, h, param_s, param_k, param_t);
+	int n = 0;
+	if (0 == strcmp(param_e, "pyramid"))
+		n = harressian(y, maxpoints, x, w, h, param_s, param_k, param_t);
+	else if (0 == strcmp(param_e, "box"))
+		n = boxhessian(y, maxpoints, x, w, h, param_s, param_k, param_t);
+	else
+		fail("unrecognized engine \"%s\"", param_e);
 
 	// write result
 	FILE *f = xfopen(filename_out, "w");
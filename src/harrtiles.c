@@ -0,0 +1,302 @@
+// temporal re-use of the harressian computations between video frames
+//
+// The frame is divided into square tiles.  When a tile of the gray image has
+// not changed since the last frame (up to a threshold on the mean absolute
+// difference), its pre-filtered image, its pyramid values and its keypoints
+// are kept from the previous frame.  The changed tiles become "dirty"
+// rectangles, which are propagated exactly (with the halos of the filters)
+// through the levels of the pyramid, and only the keypoints of the tiles
+// touched by them are detected again.
+
+#ifndef _HARRTILES_C
+#define _HARRTILES_C
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "xmalloc.c"
+#include "harressian.c"
+
+struct harressian_tiles {
+	int w, h;                  // size of the frames
+	int tile;                  // side of the tiles (at each level)
+	int max_npoints;           // capacity of each level
+	float sigma, kappa, tau;   // parameters of the cached computation
+	bool valid;                // whether the cache contains a frame
+
+	float *gray;               // reference gray frame, tile by tile
+	struct gray_image_pyramid p[1]; // persistent pyramid (level 0 filtered)
+	float *tmp[MAX_LEVELS];    // filtered level l-1, before the zoom-out
+
+	int tw[MAX_LEVELS];        // number of tiles on each level
+	int th[MAX_LEVELS];
+	int nr[MAX_LEVELS];          // number of dirty rectangles on each level
+	int *rect[MAX_LEVELS];       // dirty rectangles (i0, j0, i1, j1)
+	uint8_t *detect[MAX_LEVELS]; // tiles whose detections must be redone
+
+	int n[MAX_LEVELS];         // number of keypoints at each level
+	float *xyst[MAX_LEVELS];   // keypoints of each level
+	int *owner[MAX_LEVELS];    // tile where each keypoint was detected
+
+	int ndirty;                // statistics of the last update
+	int ntiles;
+};
+
+void harressian_tiles_init(struct harressian_tiles *t, int w, int h,
+		int tile, int max_npoints)
+{
+	t->w = w;
+	t->h = h;
+	t->tile = tile;
+	t->max_npoints = max_npoints;
+	t->sigma = t->kappa = t->tau = NAN; // (no parameters cached yet)
+	t->valid = false;
+	t->gray = xmalloc_float(w * h);
+
+	// allocate the levels with the same sizes as "fill_pyramid"
+	float *zero = xmalloc_float(w * h);
+	for (int i = 0; i < w*h; i++)
+		zero[i] = 0;
+	fill_pyramid(t->p, zero, w, h, HARRESSIAN_PYRAMID_SIGMA);
+	free(zero);
+
+	for (int l = 0; l < t->p->n; l++)
+	{
+		t->tmp[l] = l ? xmalloc_float(t->p->w[l-1] * t->p->h[l-1]) : 0;
+		t->tw[l] = (t->p->w[l] + tile - 1) / tile;
+		t->th[l] = (t->p->h[l] + tile - 1) / tile;
+		t->rect[l] = xmalloc_int(4 * t->tw[0] * t->th[0]);
+		t->nr[l] = 0;
+		t->detect[l] = xmalloc_uint8(t->tw[l] * t->th[l]);
+		t->xyst[l] = xmalloc_float(4 * max_npoints);
+		t->owner[l] = xmalloc_int(max_npoints);
+		t->n[l] = 0;
+	}
+}
+
+void harressian_tiles_free(struct harressian_tiles *t)
+{
+	for (int l = 0; l < t->p->n; l++)
+	{
+		free(t->tmp[l]);
+		free(t->rect[l]);
+		free(t->detect[l]);
+		free(t->xyst[l]);
+		free(t->owner[l]);
+	}
+	free_pyramid(t->p);
+	free(t->gray);
+}
+
+// mark the tiles of level l that intersect the rectangle [i0,i1) x [j0,j1)
+static void mark_tiles(struct harressian_tiles *t, int l,
+		int i0, int j0, int i1, int j1)
+{
+	int T = t->tile;
+	int a0 = fmax(0, i0 / T), a1 = fmin(t->tw[l], (i1 + T - 1) / T);
+	int b0 = fmax(0, j0 / T), b1 = fmin(t->th[l], (j1 + T - 1) / T);
+	for (int b = b0; b < b1; b++)
+	for (int a = a0; a < a1; a++)
+		t->detect[l][b*t->tw[l]+a] = 1;
+}
+
+// add a dirty rectangle to level l (clipped to the domain)
+static void push_rect(struct harressian_tiles *t, int l,
+		int i0, int j0, int i1, int j1)
+{
+	int *r = t->rect[l] + 4 * t->nr[l];
+	r[0] = fmax(0, i0);
+	r[1] = fmax(0, j0);
+	r[2] = fmin(t->p->w[l], i1);
+	r[3] = fmin(t->p->h[l], j1);
+	if (r[0] < r[2] && r[1] < r[3])
+		t->nr[l] += 1;
+}
+
+// find the tiles of level 0 where the new frame differs from the reference,
+// update the reference there, and build the dirty rectangles of level 0
+static void harressian_tiles_compare(struct harressian_tiles *t, float *x,
+		float threshold)
+{
+	int w = t->w, h = t->h, T = t->tile;
+	uint8_t *c = xmalloc_uint8(t->tw[0] * t->th[0]);
+	for (int b = 0; b < t->th[0]; b++)
+	for (int a = 0; a < t->tw[0]; a++)
+	{
+		int i1 = fmin(w, (a + 1) * T);
+		int j1 = fmin(h, (b + 1) * T);
+		double sad = 0;
+		for (int j = b * T; j < j1; j++)
+		for (int i = a * T; i < i1; i++)
+			sad += fabs(x[j*w+i] - t->gray[j*w+i]);
+		int np = (i1 - a*T) * (j1 - b*T);
+		c[b*t->tw[0]+a] = !t->valid || sad > threshold * np;
+		if (c[b*t->tw[0]+a])
+			for (int j = b * T; j < j1; j++)
+			for (int i = a * T; i < i1; i++)
+				t->gray[j*w+i] = x[j*w+i];
+	}
+
+	// one rectangle for each horizontal run of changed tiles, with the
+	// halo of one pixel of the pre-filter
+	t->nr[0] = 0;
+	for (int b = 0; b < t->th[0]; b++)
+	for (int a = 0; a < t->tw[0]; a++)
+	if (c[b*t->tw[0]+a])
+	{
+		int a0 = a;
+		while (a + 1 < t->tw[0] && c[b*t->tw[0]+a+1])
+			a += 1;
+		push_rect(t, 0, a0*T - 1, b*T - 1, (a+1)*T + 1, (b+1)*T + 1);
+	}
+	free(c);
+}
+
+// recompute the values of the dirty rectangles of the pyramid, level by level
+static void harressian_tiles_update_pyramid(struct harressian_tiles *t)
+{
+	struct gray_image_pyramid *p = t->p;
+
+	// level 0 is the pre-filtered frame
+	for (int k = 0; k < t->nr[0]; k++)
+	{
+		int *r = t->rect[0] + 4*k;
+		for (int j = r[1]; j < r[3]; j++)
+		for (int i = r[0]; i < r[2]; i++)
+			p->x[0][j*p->w[0]+i] = t->gray[j*p->w[0]+i];
+		poor_man_gaussian_filter_rect(p->x[0], t->gray,
+				p->w[0], p->h[0], t->sigma,
+				r[0], r[1], r[2], r[3]);
+	}
+
+	// each pixel i of level l depends on the pixels 2i-1, 2i, 2i+1 of l-1
+	for (int l = 1; l < p->n; l++)
+	{
+		int pw = p->w[l-1], ph = p->h[l-1];
+		t->nr[l] = 0;
+		for (int k = 0; k < t->nr[l-1]; k++)
+		{
+			int *q = t->rect[l-1] + 4*k;
+			push_rect(t, l, (q[0] - 1) / 2, (q[1] - 1) / 2,
+					q[2] / 2 + 1, q[3] / 2 + 1);
+		}
+		for (int k = 0; k < t->nr[l]; k++)
+		{
+			int *r = t->rect[l] + 4*k;
+			int ii0 = 2*r[0], ii1 = fmin(pw, 2*r[2] - 1);
+			int jj0 = 2*r[1], jj1 = fmin(ph, 2*r[3] - 1);
+			for (int j = jj0; j < jj1; j++)
+			for (int i = ii0; i < ii1; i++)
+				t->tmp[l][j*pw+i] = p->x[l-1][j*pw+i];
+			poor_man_gaussian_filter_rect(t->tmp[l], p->x[l-1],
+					pw, ph, HARRESSIAN_PYRAMID_SIGMA,
+					ii0, jj0, ii1, jj1);
+			for (int j = r[1]; j < r[3]; j++)
+			for (int i = r[0]; i < r[2]; i++)
+				p->x[l][j*p->w[l]+i] = t->tmp[l][2*j*pw+2*i];
+		}
+	}
+}
+
+// mark the tiles whose detections depend on dirty values: the detector and
+// the scale selection look at a few pixels around each point, on the same
+// level and on the two neighboring levels
+static void harressian_tiles_mark_detections(struct harressian_tiles *t)
+{
+	t->ndirty = t->ntiles = 0;
+	for (int l = 0; l < t->p->n; l++)
+	{
+		memset(t->detect[l], 0, t->tw[l] * t->th[l]);
+		for (int k = 0; k < t->nr[l]; k++)
+		{
+			int *r = t->rect[l] + 4*k;
+			mark_tiles(t, l, r[0]-4, r[1]-4, r[2]+4, r[3]+4);
+		}
+		for (int k = 0; l + 1 < t->p->n && k < t->nr[l+1]; k++)
+		{
+			int *r = t->rect[l+1] + 4*k;
+			mark_tiles(t, l, 2*r[0]-6, 2*r[1]-6, 2*r[2]+6, 2*r[3]+6);
+		}
+		for (int k = 0; l > 0 && k < t->nr[l-1]; k++)
+		{
+			int *r = t->rect[l-1] + 4*k;
+			mark_tiles(t, l, r[0]/2-3, r[1]/2-3, r[2]/2+3, r[3]/2+3);
+		}
+		for (int i = 0; i < t->tw[l] * t->th[l]; i++)
+			t->ndirty += t->detect[l][i];
+		t->ntiles += t->tw[l] * t->th[l];
+	}
+}
+
+// re-detect the keypoints of the marked tiles and keep the others
+static void harressian_tiles_detect(struct harressian_tiles *t)
+{
+	struct gray_image_pyramid *p = t->p;
+	int T = t->tile;
+	for (int l = 0; l < p->n; l++)
+	{
+		// remove the old keypoints of the marked tiles
+		int cx = 0;
+		for (int i = 0; i < t->n[l]; i++)
+		{
+			if (t->detect[l][t->owner[l][i]]) continue;
+			for (int k = 0; k < 4; k++)
+				t->xyst[l][4*cx+k] = t->xyst[l][4*i+k];
+			t->owner[l][cx] = t->owner[l][i];
+			cx += 1;
+		}
+
+		// add the new ones
+		for (int b = 0; b < t->th[l]; b++)
+		for (int a = 0; a < t->tw[l]; a++)
+		if (t->detect[l][b*t->tw[l]+a])
+		{
+			int n = harressian_pyramid_level(t->xyst[l] + 4*cx,
+					t->max_npoints - cx, p, l,
+					t->kappa, t->tau,
+					a*T, b*T, (a+1)*T, (b+1)*T);
+			for (int i = 0; i < n; i++)
+				t->owner[l][cx+i] = b*t->tw[l] + a;
+			cx += n;
+		}
+		t->n[l] = cx;
+	}
+}
+
+// API: compute the harressian points of a new frame, re-using the previous
+// computations on the tiles that did not change by more than "threshold"
+// (mean absolute difference of gray levels)
+int harressian_tiles(float *out_xyst, int max_npoints,
+		struct harressian_tiles *t, float *x,
+		float sigma, float kappa, float tau, float threshold)
+{
+	// any change of the parameters invalidates the whole cache
+	if (sigma != t->sigma || kappa != t->kappa || tau != t->tau)
+		t->valid = false;
+	t->sigma = sigma;
+	t->kappa = kappa;
+	t->tau = tau;
+
+	harressian_tiles_compare(t, x, threshold);
+	harressian_tiles_update_pyramid(t);
+	harressian_tiles_mark_detections(t);
+	harressian_tiles_detect(t);
+	t->valid = true;
+
+	// gather the levels, from coarse to fine (as in harressian_ms)
+	float *tmp_xyst = xmalloc_float(4 * max_npoints);
+	int n = 0;
+	for (int l = t->p->n - 1; l >= 0; l--)
+	for (int i = 0; i < t->n[l] && n < max_npoints; i++)
+	{
+		for (int k = 0; k < 4; k++)
+			tmp_xyst[4*n+k] = t->xyst[l][4*i+k];
+		n += 1;
+	}
+	int r = remove_redundant_points(out_xyst, tmp_xyst, n);
+	free(tmp_xyst);
+	return r;
+}
+
+#endif//_HARRTILES_C
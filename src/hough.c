@@ -0,0 +1,322 @@
+// hough transform of keypoints into straight lines, updated incrementally
+//
+// Each point votes for the lines (theta, rho) that pass through it, with
+// x*cos(theta) + y*sin(theta) = rho, theta in [0, pi) and rho in
+// [-rho_max, rho_max].  The cost of the votes is fixed (ntheta per point),
+// whatever the number of lines and of outliers.
+//
+// The accumulator keeps the points that voted, sorted by position.  When the
+// points of a new frame are given, only the departed points remove their
+// votes and only the new points add theirs, so that the points that stay
+// identical between frames (e.g., those of the unchanged tiles) cost nothing.
+// The votes are integers, so that removing them is exact.
+
+#ifndef _HOUGH_C
+#define _HOUGH_C
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xmalloc.c"
+#include "geometry.c"
+
+#define HOUGH_CLEAR_COST 0.1 // cost of clearing a bin, relative to a vote
+
+struct hough_point {
+	float x, y, s;
+	int i;                  // index in the array of the last update
+};
+
+struct hough_accumulator {
+	int w, h;               // domain of the points
+	int ntheta, nrho;       // size of the accumulator
+	int R;                  // index of the bin of rho=0 (nrho = 2*R+1)
+	float drho;             // width of the rho bins (in pixels)
+	bool weighted;          // whether the votes are weighted by scale
+	float *cos_t, *sin_t;
+	int *acc;               // votes, acc[theta*nrho + rho]
+
+	int n, capacity;        // points that voted (sorted by position)
+	int ninput;             // number of points given to the last update
+	struct hough_point *p;
+	struct hough_point *tmp;
+};
+
+// API: prepare an accumulator for points inside a w*h image
+void hough_init(struct hough_accumulator *h, int w, int hgt,
+		int ntheta, float drho, bool weighted, int capacity)
+{
+	h->w = w;
+	h->h = hgt;
+	h->ntheta = ntheta;
+	h->drho = drho;
+	h->R = ceil(hypot(w, hgt) / drho) + 1;
+	h->nrho = 2 * h->R + 1;
+	h->weighted = weighted;
+	h->cos_t = xmalloc_float(ntheta);
+	h->sin_t = xmalloc_float(ntheta);
+	for (int t = 0; t < ntheta; t++)
+	{
+		h->cos_t[t] = cos(t * M_PI / ntheta);
+		h->sin_t[t] = sin(t * M_PI / ntheta);
+	}
+	h->acc = xmalloc_int(ntheta * h->nrho);
+	memset(h->acc, 0, ntheta * h->nrho * sizeof*h->acc);
+	h->n = h->ninput = 0;
+	h->capacity = capacity;
+	h->p = xmalloc(capacity * sizeof*h->p);
+	h->tmp = xmalloc(capacity * sizeof*h->tmp);
+}
+
+// API
+void hough_free(struct hough_accumulator *h)
+{
+	free(h->cos_t);
+	free(h->sin_t);
+	free(h->acc);
+	free(h->p);
+	free(h->tmp);
+}
+
+static int hough_weight(struct hough_accumulator *h, struct hough_point *p)
+{
+	return h->weighted ? fmax(1, round(p->s)) : 1;
+}
+
+// add the votes of a point (with w > 0) or remove them (with w < 0)
+static void hough_vote(struct hough_accumulator *h, struct hough_point *p,
+		int w)
+{
+	int bin[h->ntheta];
+	float a = 1 / h->drho, b = h->R + 0.5;
+	for (int t = 0; t < h->ntheta; t++) // (vectorizable, and b > |rho|*a)
+		bin[t] = (p->x * h->cos_t[t] + p->y * h->sin_t[t]) * a + b;
+	int *acc = h->acc;
+	for (int t = 0; t < h->ntheta; t++, acc += h->nrho)
+		acc[bin[t]] += w;
+}
+
+static int compare_hough_points(const void *aa, const void *bb)
+{
+	const struct hough_point *a = (const struct hough_point *)aa;
+	const struct hough_point *b = (const struct hough_point *)bb;
+	if (a->y != b->y) return (a->y > b->y) - (a->y < b->y);
+	if (a->x != b->x) return (a->x > b->x) - (a->x < b->x);
+	return (a->s > b->s) - (a->s < b->s);
+}
+
+// API: replace the points of the accumulator by the points "xyst" (array of
+// x, y, scale, score) of a new frame
+// returns the number of points whose votes were added or removed
+int hough_update(struct hough_accumulator *h, float *xyst, int n)
+{
+	// the new points, sorted
+	int m = 0;
+	for (int i = 0; i < n && m < h->capacity; i++)
+	{
+		float x = xyst[4*i+0], y = xyst[4*i+1];
+		if (!(x >= 0 && y >= 0 && x <= h->w && y <= h->h)) continue;
+		h->tmp[m].x = x;
+		h->tmp[m].y = y;
+		h->tmp[m].s = xyst[4*i+2];
+		h->tmp[m].i = i;
+		m += 1;
+	}
+	qsort(h->tmp, m, sizeof*h->tmp, compare_hough_points);
+
+	// count the points that stay (merge of the two sorted lists)
+	int nstay = 0;
+	for (int i = 0, j = 0; i < h->n && j < m; )
+	{
+		int c = compare_hough_points(h->p + i, h->tmp + j);
+		if (c < 0) i++;
+		else if (c > 0) j++;
+		else { i++; j++; nstay++; }
+	}
+
+	// the update votes for the departed and the new points, and the rebuild
+	// clears the accumulator and votes for all the new points
+	int nchanged = h->n + m - 2 * nstay;
+	if (nchanged > m + HOUGH_CLEAR_COST * h->nrho) {
+		memset(h->acc, 0, h->ntheta * h->nrho * sizeof*h->acc);
+		for (int j = 0; j < m; j++)
+			hough_vote(h, h->tmp + j, hough_weight(h, h->tmp+j));
+		nchanged = m;
+	} else {
+		int i = 0, j = 0;
+		while (i < h->n || j < m)
+		{
+			int c = i == h->n ? 1 : j == m ? -1 :
+				compare_hough_points(h->p + i, h->tmp + j);
+			if (c < 0) { // departed point
+				struct hough_point *q = h->p + i++;
+				hough_vote(h, q, -hough_weight(h, q));
+			} else if (c > 0) { // new point
+				struct hough_point *q = h->tmp + j++;
+				hough_vote(h, q, hough_weight(h, q));
+			} else {
+				i++;
+				j++;
+			}
+		}
+	}
+
+	struct hough_point *t = h->p;
+	h->p = h->tmp;
+	h->tmp = t;
+	h->n = m;
+	h->ninput = n;
+	return nchanged;
+}
+
+// value of the accumulator at (t, r), where t may cross the ends of [0,pi)
+// (the line (theta+pi, rho) is the line (theta, -rho))
+static int hough_get(struct hough_accumulator *h, int t, int r)
+{
+	if (t < 0)          { t += h->ntheta; r = h->nrho - 1 - r; }
+	if (t >= h->ntheta) { t -= h->ntheta; r = h->nrho - 1 - r; }
+	if (r < 0 || r >= h->nrho) return 0;
+	return h->acc[t * h->nrho + r];
+}
+
+// votes of the band of three rho bins around (t, r): the points of a line
+// spread over neighboring rho bins, when theta is not exactly that of a bin
+static int hough_band(struct hough_accumulator *h, int t, int r)
+{
+	return hough_get(h, t, r-1) + hough_get(h, t, r) + hough_get(h, t, r+1);
+}
+
+struct hough_peak { int votes, t, r; };
+
+static float hough_distance(float *line, struct hough_point *p)
+{
+	float xy[2] = {p->x, p->y};
+	return distance_of_point_to_straight_line(line, xy, NULL);
+}
+
+static int compare_hough_peaks(const void *aa, const void *bb)
+{
+	const struct hough_peak *a = (const struct hough_peak *)aa;
+	const struct hough_peak *b = (const struct hough_peak *)bb;
+	return (a->votes < b->votes) - (a->votes > b->votes);
+}
+
+// local maxima of the votes of the bands with at least "min_votes", in
+// windows of (2*k+1)*(2*k+1) bins (the ties are broken by the position of the
+// bin)
+static int hough_peaks(struct hough_peak **out, struct hough_accumulator *h,
+		int min_votes, int k)
+{
+	int n = 0, cap = 64;
+	struct hough_peak *p = xmalloc(cap * sizeof*p);
+	for (int t = 0; t < h->ntheta; t++)
+	for (int r = 0; r < h->nrho; r++)
+	{
+		int v = hough_band(h, t, r);
+		if (v < min_votes) continue;
+		bool is_max = true;
+		for (int dt = -k; is_max && dt <= k; dt++)
+		for (int dr = -k; is_max && dr <= k; dr++)
+		{
+			if (!dt && !dr) continue;
+			int u = hough_band(h, t + dt, r + dr);
+			if (u > v || (u == v && (dt < 0 || (!dt && dr < 0))))
+				is_max = false;
+		}
+		if (!is_max) continue;
+		if (n == cap) {
+			cap *= 2;
+			p = realloc(p, cap * sizeof*p);
+			if (!p) fail("hough_peaks: out of memory");
+		}
+		p[n].votes = v;
+		p[n].t = t;
+		p[n].r = r;
+		n += 1;
+	}
+	qsort(p, n, sizeof*p, compare_hough_peaks);
+	*out = p;
+	return n;
+}
+
+// API: extract up to "max_lines" lines from the peaks of the accumulator
+// The peaks need the votes of "min_votes" points in a band of three rho bins
+// (with weighted votes, this threshold is multiplied by the mean weight of
+// the points).  Each peak is refined by total least squares fits to the
+// points near it that do not belong to a previous line, and is kept if it
+// has at least "min_inliers" points at distance less than "max_err".
+// "out_lines" gets the coefficients (a,b,c) of each line and "out_label" the
+// index of the line of each point given to the last "hough_update" (or -1),
+// if not NULL
+// returns the number of lines found
+int hough_lines(float *out_lines, int *out_label, int max_lines,
+		struct hough_accumulator *h, int min_votes, int min_inliers,
+		float max_err)
+{
+	int n = h->n, nlines = 0;
+	if (h->weighted && n) {
+		long wsum = 0;
+		for (int i = 0; i < n; i++)
+			wsum += hough_weight(h, h->p + i);
+		min_votes = ceil(min_votes * (wsum / (double)n));
+	}
+	struct hough_peak *peak;
+	int npeaks = hough_peaks(&peak, h, min_votes, 2);
+
+	int *label = xmalloc_int(n ? n : 1);
+	int *idx = xmalloc_int(n ? n : 1);
+	float *xy = xmalloc_float(2 * (n ? n : 1));
+	for (int i = 0; i < n; i++)
+		label[i] = -1;
+	for (int q = 0; q < npeaks && nlines < max_lines; q++)
+	{
+		float theta = peak[q].t * M_PI / h->ntheta;
+		float rho = (peak[q].r - h->R) * h->drho;
+		float line[3] = {cos(theta), sin(theta), -rho};
+		for (int it = 0; it < 3; it++)
+		{
+			// (the first fit gathers the voters of the band of the
+			// peak)
+			float th = it ? max_err : fmax(max_err, 1.5 * h->drho);
+			int m = 0;
+			for (int i = 0; i < n; i++)
+				if (label[i] < 0 &&
+					hough_distance(line, h->p + i) < th)
+				{
+					xy[2*m+0] = h->p[i].x;
+					xy[2*m+1] = h->p[i].y;
+					m += 1;
+				}
+			if (m < 2 || !straight_line_by_total_least_squares(line,
+						xy, m, NULL))
+				break;
+		}
+		int m = 0;
+		for (int i = 0; i < n; i++)
+			if (label[i] < 0 &&
+					hough_distance(line, h->p + i) < max_err)
+				idx[m++] = i;
+		if (m < min_inliers)
+			continue;
+		for (int k = 0; k < m; k++)
+			label[idx[k]] = nlines;
+		for (int l = 0; l < 3; l++)
+			out_lines[3*nlines+l] = line[l];
+		nlines += 1;
+	}
+	if (out_label) {
+		for (int i = 0; i < h->ninput; i++)
+			out_label[i] = -1;
+		for (int i = 0; i < n; i++)
+			out_label[h->p[i].i] = label[i];
+	}
+
+	free(xy);
+	free(idx);
+	free(label);
+	free(peak);
+	return nlines;
+}
+
+#endif//_HOUGH_C
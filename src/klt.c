@@ -0,0 +1,220 @@
+// sparse pyramidal Lucas-Kanade tracker of keypoints
+//
+// The keypoints of a full detection are followed on the next frames by
+// minimizing, around each point, the squared difference between a window of
+// the previous frame and a displaced window of the current frame (the
+// "At + Ax*u + Ay*v = 0" equation of demo_cdr, solved locally by least
+// squares and iterated).  The displacement is searched from coarse to fine
+// on the same gray image pyramid as the harressian, starting at a few levels
+// above the level where each point was detected.  Thus, apart from building
+// the pyramid, the cost of a frame is proportional to the number of tracked
+// points.
+
+#ifndef _KLT_C
+#define _KLT_C
+
+#include <math.h>
+#include <string.h>
+#include "xmalloc.c"
+#include "harressian.c"
+
+struct klt_tracker {
+	int w, h;
+	int capacity;
+	bool valid;                // whether there is a previous frame
+
+	// parameters
+	int radius;                // half side of the integration window
+	int max_iterations;        // Gauss-Newton iterations at each level
+	int extra_levels;          // coarse levels above the level of each point
+	float max_residual;        // mean absolute difference to accept a track
+	float min_eigenvalue;      // of the structure tensor (per window pixel)
+
+	struct gray_image_pyramid p[1]; // pyramid of the previous frame
+
+	int n;                     // number of tracked points
+	int n0;                    // number of points after the last detection
+	float *xyst;               // tracked points
+	int nframes;               // number of frames since the last detection
+};
+
+void klt_init(struct klt_tracker *k, int w, int h, int capacity)
+{
+	k->w = w;
+	k->h = h;
+	k->capacity = capacity;
+	k->valid = false;
+	k->radius = 3;
+	k->max_iterations = 8;
+	k->extra_levels = 3;
+	k->max_residual = 12;
+	k->min_eigenvalue = 4;
+	k->p->n = 0;
+	k->n = k->n0 = 0;
+	k->xyst = xmalloc_float(4 * capacity);
+	k->nframes = 0;
+}
+
+void klt_free(struct klt_tracker *k)
+{
+	if (k->valid)
+		free_pyramid(k->p);
+	free(k->xyst);
+}
+
+// bilinear interpolation, extended by the nearest value outside
+static float klt_bilinear(float *I, int w, int h, float x, float y)
+{
+	int i = floor(x);
+	int j = floor(y);
+	float a = x - i;
+	float b = y - j;
+	float v00 = getpixel_1(I, w, h, i  , j  );
+	float v10 = getpixel_1(I, w, h, i+1, j  );
+	float v01 = getpixel_1(I, w, h, i  , j+1);
+	float v11 = getpixel_1(I, w, h, i+1, j+1);
+	return (1-a)*(1-b)*v00 + a*(1-b)*v10 + (1-a)*b*v01 + a*b*v11;
+}
+
+// pre-filter the frame and build its pyramid (as in harressian_ms)
+static void klt_fill_pyramid(struct gray_image_pyramid *p, float *x,
+		int w, int h, float sigma)
+{
+	float *sx = xmalloc_float(w * h);
+	memcpy(sx, x, w*h*sizeof*x);
+	poor_man_gaussian_filter(sx, x, w, h, sigma);
+	fill_pyramid(p, sx, w, h, HARRESSIAN_PYRAMID_SIGMA);
+	free(sx);
+}
+
+// refine the displacement (u,v) of the point (x,y) at level l, where all the
+// quantities are in units of that level
+// returns the mean absolute residual, or INFINITY if the window is flat
+static float klt_track_level(struct klt_tracker *k,
+		struct gray_image_pyramid *q, int l,
+		float x, float y, float *u, float *v)
+{
+	float *I = k->p->x[l], *J = q->x[l];
+	int w = q->w[l], h = q->h[l];
+	int r = k->radius, np = (2*r+1) * (2*r+1);
+
+	// template and gradient of the previous frame, and structure tensor
+	float T[np], Tx[np], Ty[np];
+	double a = 0, b = 0, c = 0;
+	for (int dj = -r, m = 0; dj <= r; dj++)
+	for (int di = -r; di <= r; di++, m++)
+	{
+		float px = x + di, py = y + dj;
+		T[m] = klt_bilinear(I, w, h, px, py);
+		Tx[m] = (klt_bilinear(I, w, h, px + 1, py)
+			- klt_bilinear(I, w, h, px - 1, py)) / 2;
+		Ty[m] = (klt_bilinear(I, w, h, px, py + 1)
+			- klt_bilinear(I, w, h, px, py - 1)) / 2;
+		a += Tx[m] * Tx[m];
+		b += Tx[m] * Ty[m];
+		c += Ty[m] * Ty[m];
+	}
+	double det = a*c - b*b;
+	double lmin = (a + c)/2 - sqrt((a - c)*(a - c)/4 + b*b);
+	if (!(lmin > k->min_eigenvalue * np) || !(det > 0))
+		return INFINITY;
+
+	// Gauss-Newton iterations on the displacement
+	float e = INFINITY;
+	for (int it = 0; it < k->max_iterations; it++)
+	{
+		double bx = 0, by = 0, sad = 0;
+		for (int dj = -r, m = 0; dj <= r; dj++)
+		for (int di = -r; di <= r; di++, m++)
+		{
+			float d = T[m] - klt_bilinear(J, w, h,
+					x + *u + di, y + *v + dj);
+			bx += d * Tx[m];
+			by += d * Ty[m];
+			sad += fabs(d);
+		}
+		e = sad / np;
+		float du = ( c*bx - b*by) / det;
+		float dv = (-b*bx + a*by) / det;
+		*u += du;
+		*v += dv;
+		if (du*du + dv*dv < 0.01*0.01)
+			break;
+	}
+	return e;
+}
+
+// API: start tracking the points of a full detection on the frame "x"
+void klt_reset(struct klt_tracker *k, float *x, float sigma,
+		float *xyst, int n)
+{
+	if (n > k->capacity) n = k->capacity;
+	memcpy(k->xyst, xyst, 4*n*sizeof*xyst);
+	k->n = k->n0 = n;
+	k->nframes = 0;
+	if (k->valid)
+		free_pyramid(k->p);
+	klt_fill_pyramid(k->p, x, k->w, k->h, sigma);
+	k->valid = true;
+}
+
+// API: follow the tracked points onto the new frame "x"
+// returns the number of points that are still tracked
+int klt_track(struct klt_tracker *k, float *x, float sigma)
+{
+	struct gray_image_pyramid q[1];
+	klt_fill_pyramid(q, x, k->w, k->h, sigma);
+	if (!k->valid) {
+		*k->p = *q;
+		k->valid = true;
+		k->n = k->n0 = 0;
+		return 0;
+	}
+
+	int cx = 0;
+	for (int i = 0; i < k->n; i++)
+	{
+		float *X = k->xyst + 4*i;
+
+		// level where the point was detected (see harressian_pyramid_level)
+		int l0 = fmax(0, round(log2(X[2] * 4 / 5)));
+		if (l0 >= q->n) l0 = q->n - 1;
+		int l1 = fmin(q->n - 1, l0 + k->extra_levels);
+
+		// coarse to fine
+		float u = 0, v = 0, e = INFINITY;
+		for (int l = l1; l >= l0; l--)
+		{
+			float f = 1 << l;
+			if (l < l1) { u *= 2; v *= 2; }
+			// (the flat windows of the coarse levels are skipped)
+			e = klt_track_level(k, q, l, X[0] / f, X[1] / f, &u, &v);
+		}
+		if (!(e < k->max_residual)) continue;
+
+		// the displacements are in units of level l0
+		float nx = X[0] + u * (1 << l0);
+		float ny = X[1] + v * (1 << l0);
+		if (nx < 0 || ny < 0 || nx >= k->w || ny >= k->h) continue;
+		k->xyst[4*cx+0] = nx;
+		k->xyst[4*cx+1] = ny;
+		k->xyst[4*cx+2] = X[2];
+		k->xyst[4*cx+3] = X[3];
+		cx += 1;
+	}
+	k->n = cx;
+	k->nframes += 1;
+
+	// the new frame becomes the reference
+	free_pyramid(k->p);
+	*k->p = *q;
+	return cx;
+}
+
+// API: fraction of the points of the last detection that are still tracked
+float klt_quality(struct klt_tracker *k)
+{
+	return k->n0 ? k->n / (float)k->n0 : 0;
+}
+
+#endif//_KLT_C
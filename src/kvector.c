@@ -0,0 +1,526 @@
+// k-vector index of the triangles of the constellations
+//
+// As in the star trackers (Mortari, "Search-less algorithm for star pattern
+// recognition"), the catalog is a table of invariants sorted by a scalar
+// value, with a "k-vector" that gives any range of values without searching.
+//
+// The triangles are those of constellation.c: each dot with two of its k
+// nearest neighbors, with the vertices in canonical order and the invariants
+// r1, r2 (ratios of the sides) and o (orientation).  Their scalar value is
+// y = c + r2, where the cell c = 2*floor(r1/(2*tol)) + o, so that the
+// triangles matching (r1, r2, o) within the tolerance are in one or two
+// ranges of y.  The k-vector K[j] counts the triangles with y below the line
+// z(j) = q + m*j that joins the smallest and the largest value: the triangles
+// with y in [ya, yb] are among K[ja] ... K[jb]-1 with ja = floor((ya-q)/m)
+// and jb = ja' + 1, and only the few ones of the two end buckets may be out.
+//
+// The whole index is a single block of memory (see mapblock.c), with offsets
+// instead of pointers, which is written as it is by "kvector_save".  Thus
+// "kvector_load" only maps the file, and a large catalog is ready at once (its
+// pages are read when they are touched by the queries).
+
+#ifndef _KVECTOR_C
+#define _KVECTOR_C
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fail.c"
+#include "xmalloc.c"
+#include "mapblock.c"
+#include "constellation.c"
+
+#define KVECTOR_MAGIC "KVECTOR1"
+#define KVECTOR_SUPPORT 3 // triangles that must agree on a basis
+#define KVECTOR_AGREE 0.15 // relative tolerance of the agreement of two bases
+
+struct kvector_triangle {
+	float y, r1;        // sort value, and first ratio
+	int label;          // constellation
+	int v[3];           // its dots, in canonical order
+};
+
+// beginning of the block (and of the file)
+struct kvector_header {
+	char magic[8];
+	int32_t nlabels;    // number of constellations
+	int32_t ndots;      // number of dots of all the constellations
+	int32_t ntriangles; // number of triangles
+	int32_t nk;         // size of the k-vector
+	int32_t k;          // neighbors of each dot used to form the triangles
+	float tol;          // tolerance of the invariants
+	double m, q;        // line of the k-vector, z(j) = q + m*j
+	int64_t off_start;  // offsets (in bytes from the beginning) of the arrays
+	int64_t off_xy;
+	int64_t off_kvec;
+	int64_t off_triangle;
+	int64_t size;       // size of the block
+};
+
+struct kvector_index {
+	struct kvector_header *h;
+	int32_t *start;     // first dot of each constellation (and nlabels+1)
+	float *xy;          // coordinates of the dots
+	int32_t *kvec;      // the k-vector, K[j] for j = 0 ... nk-1
+	struct kvector_triangle *t; // triangles, sorted by y
+	bool mapped;        // whether the block is a mapped file
+};
+
+// sort value of the invariants r1, r2, o
+static double kvector_value(int cell, float r2)
+{
+	return cell + fmin(r2, 0.999999);
+}
+
+static int kvector_cell(float r1, int o, float tol)
+{
+	return 2 * constellation_bin(r1, 0, tol) + o;
+}
+
+static int compare_kvector_triangles(const void *aa, const void *bb)
+{
+	const struct kvector_triangle *a = aa, *b = bb;
+	if (a->y != b->y) return (a->y > b->y) - (a->y < b->y);
+	for (int j = 0; j < 3; j++)
+		if (a->v[j] != b->v[j])
+			return (a->v[j] > b->v[j]) - (a->v[j] < b->v[j]);
+	return 0;
+}
+
+// set the pointers to the arrays of the block
+static void kvector_set_arrays(struct kvector_index *kv)
+{
+	char *b = (char *)kv->h;
+	kv->start = (int32_t *)(b + kv->h->off_start);
+	kv->xy = (float *)(b + kv->h->off_xy);
+	kv->kvec = (int32_t *)(b + kv->h->off_kvec);
+	kv->t = (struct kvector_triangle *)(b + kv->h->off_triangle);
+}
+
+// API: index the triangles of the "nlabels" constellations given by their
+// dots (with the same arguments as "constellation_index_build")
+void kvector_build(struct kvector_index *kv, float *xy, int *start,
+		int nlabels, int k, float tol)
+{
+	if (k < 2 || k > CONSTELLATION_MAX_K)
+		fail("kvector_build: bad number of neighbors %d", k);
+	if (!(tol >= 0.001))
+		fail("kvector_build: tolerance %g too small", tol);
+
+	// the triangles of all the constellations
+	int n = 0, cap = 1024;
+	struct kvector_triangle *t = xmalloc(cap * sizeof*t);
+	for (int l = 0; l < nlabels; l++)
+	{
+		int m = start[l+1] - start[l];
+		float *lxy = xy + 2*start[l];
+		int *nb = xmalloc_int(k * (m ? m : 1));
+		constellation_neighbors(nb, lxy, m, k);
+		for (int p = 0; p < m; p++)
+		for (int a = 0; a < k; a++)
+		for (int b = a + 1; b < k; b++)
+		{
+			int *N = nb + k*p, v[3];
+			float q[3];
+			if (N[b] < 0 || !constellation_triangle(q, v, lxy,
+						p, N[a], N[b], tol))
+				continue;
+			if (n == cap) {
+				cap *= 2;
+				t = realloc(t, cap * sizeof*t);
+				if (!t) fail("kvector_build: out of memory");
+			}
+			t[n].y = kvector_value(kvector_cell(q[0], q[2], tol),
+					q[1]);
+			t[n].r1 = q[0];
+			t[n].label = l;
+			for (int j = 0; j < 3; j++)
+				t[n].v[j] = start[l] + v[j];
+			n += 1;
+		}
+		free(nb);
+	}
+
+	// sort them, without the repeated ones (formed from several vertices)
+	qsort(t, n, sizeof*t, compare_kvector_triangles);
+	int nu = 0;
+	for (int i = 0; i < n; i++)
+		if (!nu || compare_kvector_triangles(t + nu - 1, t + i))
+			t[nu++] = t[i];
+	n = nu;
+
+	// the block
+	int ndots = start[nlabels], nk = n + 2;
+	struct kvector_header h = {KVECTOR_MAGIC, nlabels, ndots, n, nk, k,
+		tol, 0, 0, 0, 0, 0, 0, 0};
+	h.off_start = mapblock_align(sizeof h);
+	h.off_xy = mapblock_align(h.off_start + (nlabels+1) * sizeof(int32_t));
+	h.off_kvec = mapblock_align(h.off_xy + 2 * ndots * sizeof(float));
+	h.off_triangle = mapblock_align(h.off_kvec + nk * sizeof(int32_t));
+	h.size = mapblock_align(h.off_triangle + n * sizeof*t);
+	kv->h = mapblock_alloc(h.size);
+	*kv->h = h;
+	kv->mapped = false;
+	kvector_set_arrays(kv);
+	for (int l = 0; l <= nlabels; l++)
+		kv->start[l] = start[l];
+	memcpy(kv->xy, xy, 2 * ndots * sizeof*xy);
+	memcpy(kv->t, t, n * sizeof*t);
+	free(t);
+
+	// the k-vector, on the line from below the first value to above the
+	// last one
+	double y0 = n ? kv->t[0].y : 0, y1 = n ? kv->t[n-1].y : 1;
+	double eps = 1e-6 * fmax(1, y1 - y0);
+	kv->h->m = (y1 - y0 + 2*eps) / (nk - 1);
+	kv->h->q = y0 - eps;
+	for (int j = 0, i = 0; j < nk; j++)
+	{
+		double z = kv->h->q + kv->h->m * j;
+		while (i < n && kv->t[i].y < z)
+			i += 1;
+		kv->kvec[j] = j == nk - 1 ? n : i;
+	}
+}
+
+// API: write the index to a file
+void kvector_save(struct kvector_index *kv, char *filename)
+{
+	mapblock_save(kv->h, kv->h->size, filename);
+}
+
+// API: map an index written by "kvector_save"
+void kvector_load(struct kvector_index *kv, char *filename)
+{
+	kv->h = mapblock_load(filename, KVECTOR_MAGIC, sizeof*kv->h,
+			offsetof(struct kvector_header, off_start), 4);
+	kv->mapped = true;
+	struct kvector_header *h = kv->h;
+	int64_t *off = &h->off_start;
+	if (!mapblock_fits(off, 0, (h->nlabels + 1L) * sizeof*kv->start)
+			|| !mapblock_fits(off, 1, 2L * h->ndots * sizeof*kv->xy)
+			|| h->nk < 1
+			|| !mapblock_fits(off, 2, (long)h->nk * sizeof*kv->kvec)
+			|| !mapblock_fits(off, 3, (long)h->ntriangles
+				* sizeof*kv->t))
+		fail("kvector_load: \"%s\" is not a k-vector index", filename);
+	kvector_set_arrays(kv);
+}
+
+// API
+void kvector_free(struct kvector_index *kv)
+{
+	mapblock_free(kv->h, kv->h->size, kv->mapped);
+}
+
+// API: range [*i0, *i1) of triangles that contains those with y in [ya, yb]
+// (and only a few others, at the ends)
+void kvector_range(int *i0, int *i1, struct kvector_index *kv,
+		double ya, double yb)
+{
+	int nk = kv->h->nk;
+	double ja = floor((ya - kv->h->q) / kv->h->m);
+	double jb = floor((yb - kv->h->q) / kv->h->m) + 1;
+	ja = fmax(0, fmin(nk - 1, ja));
+	jb = fmax(0, fmin(nk - 1, jb));
+	*i0 = kv->kvec[(int)ja];
+	*i1 = kv->kvec[(int)jb];
+}
+
+// API: call "f" on each triangle of the index that matches the invariants q
+// of a triangle (as given by "constellation_triangle")
+// returns the number of triangles found
+int kvector_lookup(struct kvector_index *kv, float q[3],
+		void (*f)(struct kvector_triangle *, void *), void *usr)
+{
+	float tol = kv->h->tol;
+	int b0 = constellation_bin(q[0] - tol, 0, tol);
+	int b1 = constellation_bin(q[0] + tol, 0, tol);
+	int r = 0;
+	for (int b = b0; b <= b1; b++)
+	{
+		int cell = 2 * b + q[2], i0, i1;
+		kvector_range(&i0, &i1, kv, cell + q[1] - tol, cell + q[1] + tol);
+		for (int i = i0; i < i1; i++)
+		{
+			struct kvector_triangle *t = kv->t + i;
+			if (fabs(t->y - cell - q[1]) <= tol && fabs(t->r1 - q[0])
+					<= tol && (int)t->y == cell)
+			{
+				f(t, usr);
+				r += 1;
+			}
+		}
+	}
+	return r;
+}
+
+// a triangle of the index matched to a triangle (p, a, b) of the frame
+struct kvector_hit {
+	int label;
+	int rp, ra, rb;     // dots matched to p, a and b
+	int b;
+	int slot;           // slot of (rp, ra) in the table of the basis
+};
+
+// the triangles of the index found for the triangles of a point of the frame
+// with two of its neighbors a < b (each of them belongs to two bases)
+struct kvector_found {
+	int n, cap;
+	struct kvector_triangle *t;
+	int f[CONSTELLATION_MAX_K*CONSTELLATION_MAX_K][3]; // canonical order
+	int range[CONSTELLATION_MAX_K*CONSTELLATION_MAX_K][2]; // of a*k+b in t
+};
+
+static void kvector_add_found(struct kvector_triangle *t, void *usr)
+{
+	struct kvector_found *F = usr;
+	if (F->n == F->cap) {
+		F->cap *= 2;
+		F->t = realloc(F->t, F->cap * sizeof*F->t);
+		if (!F->t) fail("kvector_matching: out of memory");
+	}
+	F->t[F->n++] = *t;
+}
+
+// look up the triangles of the point "p" with two of its "k" neighbors "N"
+static void kvector_find(struct kvector_found *F, struct kvector_index *kv,
+		float *xy, int p, int *N, int k)
+{
+	F->n = 0;
+	for (int a = 0; a < k && N[a] >= 0; a++)
+	for (int b = a + 1; b < k && N[b] >= 0; b++)
+	{
+		float q[3];
+		int *r = F->range[a*k+b];
+		r[0] = F->n;
+		if (constellation_triangle(q, F->f[a*k+b], xy, p, N[a], N[b],
+					kv->h->tol))
+			kvector_lookup(kv, q, kvector_add_found, F);
+		r[1] = F->n;
+	}
+}
+
+// state of "kvector_matching" for a basis: the triangles of the index matched
+// to its triangles
+struct kvector_basis {
+	int p, a;           // the vertices of the frame that are the basis
+	int nhits, cap;
+	struct kvector_hit *hit;
+};
+
+// a confirmed basis: the similarity z -> alpha*z + beta (as complex numbers)
+// that maps the basis (p, a) of the frame to its pair of dots (rp, ra)
+struct kvector_similarity {
+	int label;
+	float p[2], rp[2];  // a point of the frame and its dot
+	float alpha[2];
+};
+
+static void kvector_similarity(struct kvector_similarity *S, int label,
+		float *p, float *a, float *rp, float *ra)
+{
+	float u[2] = {a[0] - p[0], a[1] - p[1]};
+	float v[2] = {ra[0] - rp[0], ra[1] - rp[1]};
+	float d = u[0]*u[0] + u[1]*u[1];
+	S->label = label;
+	S->alpha[0] = (v[0]*u[0] + v[1]*u[1]) / d;
+	S->alpha[1] = (v[1]*u[0] - v[0]*u[1]) / d;
+	for (int j = 0; j < 2; j++)
+	{
+		S->p[j] = p[j];
+		S->rp[j] = rp[j];
+	}
+}
+
+// whether two confirmed bases give nearly the same similarity: the same
+// rotation and zoom, and the point of "A" mapped by "B" near its dot (the
+// homography is only locally a similarity, so that the tolerance grows with
+// the distance between the bases)
+static bool kvector_agree(struct kvector_similarity *A,
+		struct kvector_similarity *B)
+{
+	float da = hypot(A->alpha[0] - B->alpha[0], A->alpha[1] - B->alpha[1]);
+	if (da > KVECTOR_AGREE * hypot(B->alpha[0], B->alpha[1]))
+		return false;
+	float u[2] = {A->p[0] - B->p[0], A->p[1] - B->p[1]};
+	float x = B->rp[0] + B->alpha[0]*u[0] - B->alpha[1]*u[1];
+	float y = B->rp[1] + B->alpha[1]*u[0] + B->alpha[0]*u[1];
+	float d = hypot(A->rp[0] - B->rp[0], A->rp[1] - B->rp[1]);
+	return hypot(x - A->rp[0], y - A->rp[1]) <= KVECTOR_AGREE * d + 1;
+}
+
+// largest number of the "n" confirmed bases "S" that agree with one of them
+static int kvector_agreement(struct kvector_similarity *S, int n)
+{
+	int r = 0;
+	for (int i = 0; i < n; i++)
+	{
+		int cx = 0;
+		for (int j = 0; j < n; j++)
+			cx += kvector_agree(S + j, S + i);
+		if (cx > r) r = cx;
+	}
+	return r;
+}
+
+static int compare_kvector_similarities(const void *aa, const void *bb)
+{
+	const struct kvector_similarity *a = aa, *b = bb;
+	return (a->label > b->label) - (a->label < b->label);
+}
+
+// add the triangle "t" matched to the triangle "f" of the basis (in
+// canonical order)
+static void kvector_add_hit(struct kvector_basis *B, struct kvector_triangle *t,
+		int *f)
+{
+	if (B->nhits == B->cap) {
+		B->cap *= 2;
+		B->hit = realloc(B->hit, B->cap * sizeof*B->hit);
+		if (!B->hit) fail("kvector_matching: out of memory");
+	}
+	struct kvector_hit *H = B->hit + B->nhits++;
+	H->label = t->label;
+	for (int j = 0; j < 3; j++)
+		if (f[j] == B->p) H->rp = t->v[j];
+		else if (f[j] == B->a) H->ra = t->v[j];
+		else {
+			H->rb = t->v[j];
+			H->b = f[j];
+		}
+}
+
+// API: recognize one of the indexed constellations among the points "xy"
+// (with the same arguments as "constellation_matching")
+// Each pair (p, a) of a point and one of its neighbors is a basis: the
+// triangles that it forms with the other neighbors are looked up, and the
+// (constellation, pair of dots) matched by KVECTOR_SUPPORT of them give their
+// correspondences.  The random confirmed bases are many in a large catalog,
+// but those of the true constellation map the frame to its dots by about the
+// same similarity, so that the constellations are ranked by their largest
+// set of bases that agree (which is "out->nvotes"), and the first ones are
+// verified by a homography.
+// returns the number of inliers (0 if no constellation was recognized)
+int kvector_matching(struct constellation_match *out,
+		struct kvector_index *kv, float *xy, int n, int k,
+		int ncandidates, float max_err, int min_inliers, uint64_t seed)
+{
+	int nlabels = kv->h->nlabels;
+	out->label = -1;
+	out->nvotes = out->ncorrespondences = out->ninliers = 0;
+	if (k > CONSTELLATION_MAX_K) k = CONSTELLATION_MAX_K;
+	if (n < 4 || k < 2 || nlabels < 1)
+		return 0;
+
+	int *nb = xmalloc_int(k * n);
+	constellation_neighbors(nb, xy, n, k);
+	int *bases = xmalloc_int(3 * nlabels), *npairs = bases + nlabels;
+	int *voted = npairs + nlabels, nvoted = 0; // constellations with votes
+	memset(bases, 0, 2 * nlabels * sizeof*bases);
+	struct constellation_votes V[1], G[1];
+	constellation_votes_init(V, 12);
+	constellation_votes_init(G, 10);
+	uint64_t ndots = kv->h->ndots;
+	struct kvector_basis B[1] = {{.cap = 64}};
+	B->hit = xmalloc(B->cap * sizeof*B->hit);
+	struct kvector_found F[1] = {{.cap = 256}};
+	F->t = xmalloc(F->cap * sizeof*F->t);
+	int nsim = 0, csim = 64; // the confirmed bases
+	struct kvector_similarity *sim = xmalloc(csim * sizeof*sim);
+	for (int p = 0; p < n; p++)
+	for (int a = 0; a < k; a++)
+	{
+		int *N = nb + k*p;
+		if (N[a] < 0) break;
+		if (!a)
+			kvector_find(F, kv, xy, p, N, k);
+		B->p = p;
+		B->a = N[a];
+		B->nhits = 0;
+		for (int b = 0; b < k && N[b] >= 0; b++)
+		{
+			if (b == a) continue;
+			int j = a < b ? a*k + b : b*k + a;
+			for (int i = F->range[j][0]; i < F->range[j][1]; i++)
+				kvector_add_hit(B, F->t + i, F->f[j]);
+		}
+		if (B->nhits < KVECTOR_SUPPORT)
+			continue;
+
+		// count the triangles that agree on each (constellation, pair of
+		// dots), in a table emptied after each basis (and large enough
+		// for all the hits, so that their slots stay in place)
+		struct kvector_hit *hit = B->hit;
+		if (2 * B->nhits > 1 << G->bits) {
+			int bits = G->bits;
+			while (2 * B->nhits > 1 << bits)
+				bits += 1;
+			free(G->t);
+			constellation_votes_init(G, bits);
+		}
+		for (int i = 0; i < B->nhits; i++)
+		{
+			hit[i].slot = constellation_votes_slot(G, 1 +
+					hit[i].rp*ndots + hit[i].ra, hit[i].label);
+			G->t[hit[i].slot].count += 1;
+		}
+
+		// vote for the correspondences of the confirmed bases
+		for (int i = 0; i < B->nhits; i++)
+		{
+			struct constellation_pair *P = G->t + hit[i].slot;
+			int l = hit[i].label;
+			if (P->count < KVECTOR_SUPPORT)
+				continue;
+			if (P->label >= 0) { // (first hit of the basis)
+				P->label = -1;
+				if (!bases[l]++)
+					voted[nvoted++] = l;
+				if (nsim == csim) {
+					csim *= 2;
+					sim = realloc(sim, csim * sizeof*sim);
+					if (!sim) fail("kvector_matching: "
+							"out of memory");
+				}
+				kvector_similarity(sim + nsim++, l, xy + 2*p,
+						xy + 2*N[a], kv->xy + 2*hit[i].rp,
+						kv->xy + 2*hit[i].ra);
+				npairs[l] += 1 == constellation_votes_add(V,
+						1 + p*ndots + hit[i].rp, l);
+				npairs[l] += 1 == constellation_votes_add(V,
+						1 + N[a]*ndots + hit[i].ra, l);
+			}
+			npairs[l] += 1 == constellation_votes_add(V,
+					1 + hit[i].b*ndots + hit[i].rb, l);
+		}
+		for (int i = 0; i < B->nhits; i++)
+			G->t[hit[i].slot].key = 0;
+		G->n = 0;
+	}
+
+	// verify the constellations with most confirmed bases that agree
+	qsort(sim, nsim, sizeof*sim, compare_kvector_similarities);
+	for (int i = 0, j = 0; i < nsim; i = j)
+	{
+		while (j < nsim && sim[j].label == sim[i].label)
+			j += 1;
+		bases[sim[i].label] = kvector_agreement(sim + i, j - i);
+	}
+	constellation_candidates(out, voted, nvoted, bases, npairs, kv->xy,
+			ndots, xy, V, ncandidates, max_err, min_inliers, seed);
+
+	free(sim);
+	free(F->t);
+	free(B->hit);
+	free(G->t);
+	free(V->t);
+	free(bases);
+	free(nb);
+	return out->ninliers;
+}
+
+#endif//_KVECTOR_C
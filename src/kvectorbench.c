@@ -0,0 +1,125 @@
+// compare the k-vector lookup of triangles with a brute-force scan
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "kvector.c"
+#include "constellation_synth.c"
+#include "pickopt.c"
+#include "seconds.c"
+
+static void count_hit(struct kvector_triangle *t, void *usr)
+{
+	(void)t;
+	*(long *)usr += 1;
+}
+
+// the same as "kvector_lookup", by a scan of all the triangles
+static int brute_force_lookup(struct kvector_index *kv, float q[3])
+{
+	float tol = kv->h->tol;
+	int r = 0;
+	for (int i = 0; i < kv->h->ntriangles; i++)
+	{
+		struct kvector_triangle *t = kv->t + i;
+		int cell = t->y;
+		r += cell % 2 == q[2] && fabs(t->r1 - q[0]) <= tol
+			&& fabs(t->y - cell - q[1]) <= tol;
+	}
+	return r;
+}
+
+int main(int c, char *v[])
+{
+	// extract named options
+	int nlabels = atoi(pick_option(&c, &v, "l", "1000"));
+	int ndots = atoi(pick_option(&c, &v, "d", "60"));
+	int nclutter = atoi(pick_option(&c, &v, "c", "300"));
+	int k = atoi(pick_option(&c, &v, "k", "6"));
+	float tol = atof(pick_option(&c, &v, "t", "0.01"));
+	int nrep = atoi(pick_option(&c, &v, "r", "10"));
+	if (c != 1 && c != 2)
+		return fprintf(stderr, "usage:\n\t%s [-l nlabels] [-d ndots] "
+				"[-c nclutter] [-k neighbors] [-t tol] "
+				"[-r nrep] [index.kv]\n", *v);
+	char *filename = c == 2 ? v[1] : NULL;
+
+	// random constellations
+	srand(1);
+	int *start = xmalloc_int(nlabels + 1);
+	float *xy = xmalloc_float(2 * nlabels * ndots);
+	synth_constellations(xy, start, nlabels, ndots);
+
+	struct kvector_index kv[1];
+	double t = seconds();
+	kvector_build(kv, xy, start, nlabels, k, tol);
+	printf("%d constellations of %d dots, %d triangles, built in %.1f ms\n",
+			nlabels, ndots, kv->h->ntriangles,
+			1000 * (seconds() - t));
+	if (filename) {
+		kvector_save(kv, filename);
+		kvector_free(kv);
+		t = seconds();
+		kvector_load(kv, filename);
+		printf("index of %.1f MB mapped in %.3f ms\n",
+				kv->h->size / 1048576.0, 1000 * (seconds() - t));
+	}
+
+	// lookup of the triangles of the frames
+	float *f = xmalloc_float(2 * (ndots + nclutter));
+	int kf = k + 2, *nb = xmalloc_int(kf * (ndots + nclutter));
+	double t_kvec = 0, t_brute = 0, t_match = 0;
+	long ntri = 0, nhits = 0, nbrute = 0, ntri_brute = 0;
+	int ngood = 0;
+	for (int r = 0; r < nrep; r++)
+	{
+		int l = rand() % nlabels;
+		float H[9];
+		synth_homography(H, 0.001);
+		int n = synth_frame(f, kv->xy + 2*kv->start[l],
+				kv->start[l+1] - kv->start[l], H, nclutter);
+		constellation_neighbors(nb, f, n, kf);
+		for (int p = 0; p < n; p++)
+		for (int a = 0; a < kf; a++)
+		for (int b = a + 1; b < kf; b++)
+		{
+			int *N = nb + kf*p, w[3];
+			float q[3];
+			if (N[b] < 0 || !constellation_triangle(q, w, f,
+						p, N[a], N[b], tol))
+				continue;
+			ntri += 1;
+			t = seconds();
+			kvector_lookup(kv, q, count_hit, &nhits);
+			t_kvec += seconds() - t;
+			if (r) continue; // (the brute force is slow)
+			ntri_brute += 1;
+			t = seconds();
+			nbrute += brute_force_lookup(kv, q);
+			t_brute += seconds() - t;
+		}
+		if (!r && nhits != nbrute)
+			fail("kvector_lookup found %ld triangles instead of %ld",
+					nhits, nbrute);
+
+		struct constellation_match m[1];
+		t = seconds();
+		kvector_matching(m, kv, f, n, kf, 5, 3, 10, r);
+		t_match += seconds() - t;
+		ngood += m->label == l && m->ninliers > 0;
+	}
+	printf("%.1f triangles by frame, %.1f hits by triangle\n",
+			ntri / (double)nrep, nhits / (double)ntri);
+	printf("k-vector    %10.3f us/triangle %10.3f ms/frame\n",
+			1e6 * t_kvec / ntri, 1000 * t_kvec / nrep);
+	printf("brute force %10.3f us/triangle %10.3f ms/frame (first)\n",
+			1e6 * t_brute / ntri_brute, 1000 * t_brute);
+	printf("matching    %d/%d recognized %10.3f ms/frame\n",
+			ngood, nrep, 1000 * t_match / nrep);
+
+	kvector_free(kv);
+	free(nb);
+	free(f);
+	free(xy);
+	free(start);
+	return 0;
+}
@@ -0,0 +1,276 @@
+// tracking of a recognized constellation from frame to frame
+//
+// Once a constellation has been recognized in a frame, its homography is a
+// good prediction of where its dots are in the next frame.  Each dot is then
+// matched to the nearest point of the frame within a gate around its
+// predicted position, found in a grid of the points with cells of the size of
+// the gate, and the homography is refitted by weighted least squares on these
+// correspondences (with Tukey weights of their residuals, so that the points
+// of the clutter caught by the gates barely count).  The cost of a frame is
+// the grid of its points plus a few cells for each dot, instead of a full
+// recognition.
+//
+// The lock is lost when the ratio of dots verified by the refitted homography
+// (among those predicted inside the frame) falls below a threshold, and the
+// next frame runs a full recognition again (see "labellock_frame").
+
+#ifndef _LABELLOCK_C
+#define _LABELLOCK_C
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xmalloc.c"
+#include "geometry.c"
+#include "constellation.c"
+
+#define LABELLOCK_ITERATIONS 3 // refits of the homography in each frame
+
+struct labellock {
+	// parameters
+	float gate;         // radius of the gates around the predicted dots
+	float max_err;      // error of the dots verified by the homography
+	float min_ratio;    // ratio of verified dots below which the lock is lost
+
+	// state
+	int label;          // locked constellation (or -1)
+	float H[9];         // its homography, from the last frame
+	int ndots;
+	float *dots;        // coordinates of its dots (not owned)
+	int ninliers;       // dots verified in the last frame
+	float ratio;        // their ratio to the dots predicted inside the frame
+	int nframes;        // frames tracked since the lock
+
+	// grid of the points of the frame (reused from frame to frame)
+	int gw, gh, cap_cells, cap_points;
+	float x0, y0, cs;
+	int *start, *cell;
+	float *sorted;
+	float *pairs, *w;   // correspondences of the dots, and their weights
+};
+
+// API: initialize an unlocked tracker
+void labellock_init(struct labellock *L, float gate, float max_err,
+		float min_ratio)
+{
+	memset(L, 0, sizeof*L);
+	L->gate = gate;
+	L->max_err = max_err;
+	L->min_ratio = min_ratio;
+	L->label = -1;
+}
+
+// API
+void labellock_free(struct labellock *L)
+{
+	free(L->start);
+	free(L->cell);
+	free(L->sorted);
+	free(L->pairs);
+	free(L->w);
+}
+
+// API: lock on the constellation of a match (of "ndots" dots at "dots")
+void labellock_start(struct labellock *L, struct constellation_match *m,
+		float *dots, int ndots)
+{
+	L->label = m->label;
+	for (int i = 0; i < 9; i++)
+		L->H[i] = m->H[i];
+	L->dots = dots;
+	L->ndots = ndots;
+	L->ninliers = m->ninliers;
+	L->ratio = 1;
+	L->nframes = 0;
+	L->pairs = realloc(L->pairs, 4 * (ndots + 1) * sizeof*L->pairs);
+	L->w = realloc(L->w, (ndots + 1) * sizeof*L->w);
+	if (!L->pairs || !L->w)
+		fail("labellock_start: out of memory");
+}
+
+// sort the points by cells of the size of the gate
+static void labellock_grid(struct labellock *L, float *xy, int n)
+{
+	float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+	for (int i = 0; i < n; i++)
+	{
+		x0 = fmin(x0, xy[2*i+0]); x1 = fmax(x1, xy[2*i+0]);
+		y0 = fmin(y0, xy[2*i+1]); y1 = fmax(y1, xy[2*i+1]);
+	}
+	float cs = fmax(L->gate, fmax(x1 - x0, y1 - y0) / 1024);
+	L->x0 = x0;
+	L->y0 = y0;
+	L->cs = cs;
+	L->gw = 1 + fmin(1024, (x1 - x0) / cs); // (1024 if not finite)
+	L->gh = 1 + fmin(1024, (y1 - y0) / cs);
+	if (L->gw * L->gh + 1 > L->cap_cells) {
+		L->cap_cells = L->gw * L->gh + 1;
+		free(L->start);
+		L->start = xmalloc_int(L->cap_cells);
+	}
+	if (n > L->cap_points) {
+		L->cap_points = n;
+		free(L->cell);
+		free(L->sorted);
+		L->cell = xmalloc_int(n);
+		L->sorted = xmalloc_float(2 * n);
+	}
+	int *start = L->start, ncells = L->gw * L->gh;
+	for (int q = 0; q <= ncells; q++)
+		start[q] = 0;
+	for (int i = 0; i < n; i++)
+	{
+		int ix = fmin(L->gw - 1, (xy[2*i+0] - x0) / cs);
+		int iy = fmin(L->gh - 1, (xy[2*i+1] - y0) / cs);
+		L->cell[i] = iy * L->gw + ix;
+		start[L->cell[i]+1] += 1;
+	}
+	for (int q = 0; q < ncells; q++)
+		start[q+1] += start[q];
+	for (int i = 0; i < n; i++) // (start is shifted by one cell)
+	{
+		int p = start[L->cell[i]]++;
+		L->sorted[2*p+0] = xy[2*i+0];
+		L->sorted[2*p+1] = xy[2*i+1];
+	}
+	for (int q = ncells; q > 0; q--)
+		start[q] = start[q-1];
+	start[0] = 0;
+}
+
+// nearest point of the grid to "p", at distance less than "r" (<= gate)
+// returns its distance, or INFINITY if there is none
+static float labellock_nearest(float out[2], struct labellock *L, float p[2],
+		float r)
+{
+	float best = r;
+	bool found = false;
+	int cx = fmax(-2, fmin(L->gw + 1, floor((p[0] - L->x0) / L->cs)));
+	int cy = fmax(-2, fmin(L->gh + 1, floor((p[1] - L->y0) / L->cs)));
+	for (int iy = cy - 1; iy <= cy + 1; iy++)
+	for (int ix = cx - 1; ix <= cx + 1; ix++)
+	{
+		if (ix < 0 || iy < 0 || ix >= L->gw || iy >= L->gh)
+			continue;
+		int *s = L->start + iy*L->gw + ix;
+		for (int q = s[0]; q < s[1]; q++)
+		{
+			float *x = L->sorted + 2*q;
+			float d = hypot(x[0] - p[0], x[1] - p[1]);
+			if (d < best) {
+				best = d;
+				out[0] = x[0];
+				out[1] = x[1];
+				found = true;
+			}
+		}
+	}
+	return found ? best : INFINITY;
+}
+
+// match the dots predicted by the homography within gates of radius "r",
+// with the weights of their residuals, and count in "nvisible" the dots
+// predicted inside the grid
+// returns the number of correspondences
+static int labellock_match(struct labellock *L, float r, int *nvisible)
+{
+	int m = 0;
+	*nvisible = 0;
+	for (int i = 0; i < L->ndots; i++)
+	{
+		float *d = L->dots + 2*i, p[2], x[2] = {0, 0};
+		float z = L->H[6]*d[0] + L->H[7]*d[1] + L->H[8];
+		if (!(fabs(z) > 1e-8)) continue;
+		p[0] = (L->H[0]*d[0] + L->H[1]*d[1] + L->H[2]) / z;
+		p[1] = (L->H[3]*d[0] + L->H[4]*d[1] + L->H[5]) / z;
+		*nvisible += p[0] >= L->x0 && p[0] < L->x0 + L->gw * L->cs
+			&& p[1] >= L->y0 && p[1] < L->y0 + L->gh * L->cs;
+		float e = labellock_nearest(x, L, p, r);
+		if (!(e < r)) continue;
+		float t = 1 - (e / r) * (e / r);
+		float *P = L->pairs + 4*m;
+		P[0] = d[0];
+		P[1] = d[1];
+		P[2] = x[0];
+		P[3] = x[1];
+		L->w[m] = t * t;
+		m += 1;
+	}
+	return m;
+}
+
+// API: track the locked constellation among the points "xy" of a new frame
+// The gates start at the radius "gate" and shrink to 2*max_err over the
+// refits.  Returns the number of dots verified by the new homography, or 0
+// if the lock was lost (or there was no lock).
+int labellock_track(struct labellock *L, float *xy, int n)
+{
+	if (L->label < 0)
+		return 0;
+	if (n < 4) { // (no homography can be fitted)
+		L->label = -1;
+		return 0;
+	}
+	labellock_grid(L, xy, n);
+	float H[9];
+	for (int i = 0; i < 9; i++)
+		H[i] = L->H[i];
+	int m = 0, nvisible = 0;
+	for (int it = 0; it < LABELLOCK_ITERATIONS; it++)
+	{
+		float a = it / (LABELLOCK_ITERATIONS - 1.0);
+		float r = L->gate * pow(2 * L->max_err / L->gate, a);
+		m = labellock_match(L, r, &nvisible);
+		if (!homography_by_weighted_dlt(L->H, L->pairs, L->w, m)
+				|| !homography_is_acceptable(L->H, NULL))
+		{
+			m = 0;
+			break;
+		}
+	}
+
+	// verification with the refitted homography
+	int ninliers = 0;
+	for (int i = 0; i < m; i++)
+		ninliers += homography_transfer_error(L->H, L->pairs + 4*i,
+				NULL) < L->max_err;
+	L->ratio = ninliers / fmax(1, nvisible);
+	if (ninliers < 4 || L->ratio < L->min_ratio) {
+		for (int i = 0; i < 9; i++)
+			L->H[i] = H[i];
+		L->label = -1;
+		return 0;
+	}
+	L->nframes += 1;
+	L->ninliers = ninliers;
+	return ninliers;
+}
+
+// API: recognize the constellation of a frame with the index "c", by the
+// tracking of the locked one, or by a full recognition when it is not locked
+// (with the same arguments as "constellation_matching")
+// returns the number of inliers (0 if no constellation was recognized)
+int labellock_frame(struct constellation_match *out, struct labellock *L,
+		struct constellation_index *c, float *xy, int n, int k,
+		int ncandidates, int min_inliers, uint64_t seed)
+{
+	if (labellock_track(L, xy, n)) {
+		out->label = L->label;
+		out->nvotes = out->ncorrespondences = 0;
+		out->ninliers = L->ninliers;
+		for (int i = 0; i < 9; i++)
+			out->H[i] = L->H[i];
+		return out->ninliers;
+	}
+	constellation_matching(out, c, xy, n, k, ncandidates, L->max_err,
+			min_inliers, seed);
+	if (out->ninliers > 0) {
+		int l = out->label;
+		labellock_start(L, out, c->xy + 2*c->start[l],
+				c->start[l+1] - c->start[l]);
+	}
+	return out->ninliers;
+}
+
+#endif//_LABELLOCK_C
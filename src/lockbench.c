@@ -0,0 +1,122 @@
+// compare the tracking of a locked constellation with its full recognition
+// in each frame of a sequence
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "labellock.c"
+#include "constellation_synth.c"
+#include "pickopt.c"
+#include "seconds.c"
+
+// homography of the frame t of a shot: a slow rotation, zoom and drift, with
+// some perspective
+static void shot_homography(float H[9], float *shot, int t)
+{
+	float a = shot[0] + 0.01 * t, s = shot[1] * (1 + 0.002 * t);
+	H[0] = s * cos(a); H[1] = -s * sin(a); H[2] = 300 + shot[2] * t;
+	H[3] = s * sin(a); H[4] =  s * cos(a); H[5] = 200 + shot[3] * t;
+	H[6] = shot[4]; H[7] = shot[5]; H[8] = 1;
+}
+
+static void apply_homography(float y[2], float H[9], float x[2])
+{
+	float z = H[6]*x[0] + H[7]*x[1] + H[8];
+	y[0] = (H[0]*x[0] + H[1]*x[1] + H[2]) / z;
+	y[1] = (H[3]*x[0] + H[4]*x[1] + H[5]) / z;
+}
+
+// mean distance between the dots of "l" through the true and estimated H
+static float homography_error(struct constellation_index *c, int l,
+		float T[9], float H[9])
+{
+	double e = 0;
+	for (int i = c->start[l]; i < c->start[l+1]; i++)
+	{
+		float *p = c->xy + 2*i, a[2], b[2];
+		apply_homography(a, T, p);
+		apply_homography(b, H, p);
+		e += hypot(a[0] - b[0], a[1] - b[1]);
+	}
+	return e / (c->start[l+1] - c->start[l]);
+}
+
+int main(int c, char *v[])
+{
+	// extract named options
+	int nlabels = atoi(pick_option(&c, &v, "l", "1000"));
+	int ndots = atoi(pick_option(&c, &v, "d", "60"));
+	int nclutter = atoi(pick_option(&c, &v, "c", "300"));
+	int k = atoi(pick_option(&c, &v, "k", "6"));
+	float tol = atof(pick_option(&c, &v, "t", "0.01"));
+	int nframes = atoi(pick_option(&c, &v, "f", "200"));
+	int shot_length = atoi(pick_option(&c, &v, "s", "50"));
+	float gate = atof(pick_option(&c, &v, "g", "8"));
+	float min_ratio = atof(pick_option(&c, &v, "m", "0.5"));
+	if (c != 1)
+		return fprintf(stderr, "usage:\n\t%s [-l nlabels] [-d ndots] "
+				"[-c nclutter] [-k neighbors] [-t tol] "
+				"[-f nframes] [-s shot_length] [-g gate] "
+				"[-m min_ratio]\n", *v);
+
+	// random constellations
+	srand(1);
+	int *start = xmalloc_int(nlabels + 1);
+	float *xy = xmalloc_float(2 * nlabels * ndots);
+	synth_constellations(xy, start, nlabels, ndots);
+	struct constellation_index ci[1];
+	constellation_index_build(ci, xy, start, nlabels, k, tol);
+
+	// shots of a constellation, with a cut every "shot_length" frames
+	struct labellock L[1];
+	labellock_init(L, gate, 3, min_ratio);
+	float *f = xmalloc_float(2 * (ndots + nclutter));
+	double t_full = 0, t_lock = 0, err = 0;
+	int ngood_full = 0, ngood_lock = 0, ntracked = 0, nlocks = 0, l = 0;
+	float shot[6] = {0}, H[9];
+	for (int t = 0; t < nframes; t++)
+	{
+		if (t % shot_length == 0) {
+			l = rand() % nlabels;
+			shot[0] = 6.3 * random_float();
+			shot[1] = 2 + 2 * random_float();
+			shot[2] = 2 * (random_float() - 0.5);
+			shot[3] = 2 * (random_float() - 0.5);
+			shot[4] = 0.0005 * (random_float() - 0.5);
+			shot[5] = 0.0005 * (random_float() - 0.5);
+		}
+		shot_homography(H, shot, t % shot_length);
+		int n = synth_frame(f, ci->xy + 2*ci->start[l],
+				ci->start[l+1] - ci->start[l], H, nclutter);
+
+		struct constellation_match m[1];
+		double t0 = seconds();
+		constellation_matching(m, ci, f, n, k + 2, 5, 3, 10, t);
+		t_full += seconds() - t0;
+		ngood_full += m->label == l && m->ninliers > 0;
+
+		t0 = seconds();
+		labellock_frame(m, L, ci, f, n, k + 2, 5, 10, t);
+		t_lock += seconds() - t0;
+		bool good = m->label == l && m->ninliers > 0;
+		ngood_lock += good;
+		ntracked += L->label >= 0 && L->nframes > 0;
+		nlocks += L->label >= 0 && L->nframes == 0;
+		if (good)
+			err += homography_error(ci, l, H, m->H);
+	}
+	printf("%d frames, shots of %d frames, %d constellations\n",
+			nframes, shot_length, nlabels);
+	printf("full matching %4d/%d recognized %10.3f ms/frame\n",
+			ngood_full, nframes, 1000 * t_full / nframes);
+	printf("locked        %4d/%d recognized %10.3f ms/frame\n",
+			ngood_lock, nframes, 1000 * t_lock / nframes);
+	printf("%d frames tracked, %d locks, mean error %.3f pixels\n",
+			ntracked, nlocks, err / fmax(1, ngood_lock));
+
+	labellock_free(L);
+	constellation_index_free(ci);
+	free(f);
+	free(xy);
+	free(start);
+	return 0;
+}
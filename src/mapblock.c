@@ -0,0 +1,94 @@
+// single blocks of memory that are written to a file as they are, and mapped
+// back by "mmap"
+//
+// A block begins with a header whose first 8 bytes are a magic string, and
+// whose arrays are given by offsets (in bytes from the beginning) instead of
+// pointers: the header stores them as consecutive int64_t, in increasing
+// order, followed by the size of the block.  The arrays are aligned to 64
+// bytes.  The indexes of kvector.c and quads.c are such blocks.
+
+#ifndef _MAPBLOCK_C
+#define _MAPBLOCK_C
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "fail.c"
+#include "xmalloc.c"
+#include "xfopen.c"
+
+#define MAPBLOCK_ALIGN 64
+
+// API: first aligned offset at or after "x"
+static int64_t mapblock_align(int64_t x)
+{
+	return (x + MAPBLOCK_ALIGN - 1) & ~(int64_t)(MAPBLOCK_ALIGN - 1);
+}
+
+// API: a new block of "size" bytes, filled with zeros
+void *mapblock_alloc(int64_t size)
+{
+	void *b = xmalloc(size);
+	memset(b, 0, size);
+	return b;
+}
+
+// API: write the "size" bytes of a block to a file
+void mapblock_save(void *b, int64_t size, char *filename)
+{
+	FILE *f = xfopen(filename, "w");
+	if (fwrite(b, size, 1, f) != 1)
+		fail("mapblock_save: can not write \"%s\"", filename);
+	xfclose(f);
+}
+
+// API: map a block written by "mapblock_save"
+// The file must begin with "magic", and its header of "header_size" bytes
+// must have, at "off_offsets", "noffsets" offsets followed by the size of the
+// file, such that each array lies inside the block.
+void *mapblock_load(char *filename, char *magic, size_t header_size,
+		size_t off_offsets, int noffsets)
+{
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		fail("mapblock_load: can not open \"%s\"", filename);
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < (off_t)header_size)
+		fail("mapblock_load: bad file \"%s\"", filename);
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED)
+		fail("mapblock_load: can not map \"%s\"", filename);
+	int64_t *off = (int64_t *)((char *)p + off_offsets);
+	bool good = !memcmp(p, magic, 8) && off[noffsets] == st.st_size;
+	for (int i = 0; good && i < noffsets; i++)
+		good = off[i] >= (int64_t)header_size && off[i] <= off[i+1]
+			&& off[i] % MAPBLOCK_ALIGN == 0;
+	if (!good)
+		fail("mapblock_load: \"%s\" is not a %.8s file", filename,
+				magic);
+	return p;
+}
+
+// API: whether the array "i" of a block has room for "nbytes" bytes
+// ("off" are the offsets of the header, followed by the size)
+static bool mapblock_fits(int64_t *off, int i, int64_t nbytes)
+{
+	return nbytes >= 0 && off[i+1] - off[i] >= nbytes;
+}
+
+// API
+void mapblock_free(void *b, int64_t size, bool mapped)
+{
+	if (mapped)
+		munmap(b, size);
+	else
+		free(b);
+}
+
+#endif//_MAPBLOCK_C
@@ -0,0 +1,369 @@
+// extraction of several straight lines from a set of points, in one pass
+//
+// Instead of running RANSAC once for each line and drawing new samples after
+// removing the inliers of the previous line, a single pool of line hypotheses
+// (through pairs of points) is drawn and evaluated on all the points.  Then
+// the lines are extracted sequentially from the pool: the hypothesis with
+// most inliers is refitted by total least squares to its inliers, these
+// points are removed, and the inlier counts of the remaining hypotheses are
+// decreased by the removed points that were their inliers.  The pool grows
+// by chunks, only until its best hypothesis can be trusted, so that the lines
+// that are found early do not pay for the search of the small ones.  The
+// hypotheses drawn after an extraction only go through the points that are
+// not yet labeled.
+//
+// To count the inliers of a hypothesis, only the points of the grid cells
+// crossed by the band of width 2*max_err around the line are evaluated.  The
+// points are sorted by cells in two orders (by columns and by rows), so that
+// the cells crossed by the band in each column (or each row, for the lines
+// closer to vertical) are contiguous in memory.
+
+#ifndef _MULTILINE_C
+#define _MULTILINE_C
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include "xmalloc.c"
+#include "random.c"
+#include "sampler.c"
+#include "ransac.c"
+#include "geometry.c"
+
+#define MULTILINE_CHUNK 32 // hypotheses drawn between the checks of the pool
+
+// grid of points, sorted by cells in column-major order (o=0) and in
+// row-major order (o=1)
+struct multiline_grid {
+	int g;            // number of cells on each side
+	float x0, y0, cs; // origin and side of the cells
+	int *start[2];    // first point of each cell, and end (g*g+1)
+	float *soa[2];    // coordinates of the sorted points (x array, y array)
+};
+
+static void multiline_grid_init(struct multiline_grid *G, float *xy, int n)
+{
+	float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+	for (int i = 0; i < n; i++)
+	{
+		x0 = fmin(x0, xy[2*i+0]); x1 = fmax(x1, xy[2*i+0]);
+		y0 = fmin(y0, xy[2*i+1]); y1 = fmax(y1, xy[2*i+1]);
+	}
+	G->g = fmax(1, fmin(64, sqrt(n / 2.0)));
+	G->x0 = x0;
+	G->y0 = y0;
+	G->cs = fmax(fmax(x1 - x0, y1 - y0) / G->g, 1e-6);
+	int g = G->g, *cell = xmalloc_int(n);
+	for (int o = 0; o < 2; o++)
+	{
+		int *start = G->start[o] = xmalloc_int(g*g + 1);
+		float *soa = G->soa[o] = xmalloc_float(2 * n);
+		for (int q = 0; q <= g*g; q++)
+			start[q] = 0;
+		for (int i = 0; i < n; i++)
+		{
+			int ix = fmin(g - 1, (xy[2*i+0] - x0) / G->cs);
+			int iy = fmin(g - 1, (xy[2*i+1] - y0) / G->cs);
+			cell[i] = o ? iy*g + ix : ix*g + iy;
+			start[cell[i]+1] += 1;
+		}
+		for (int q = 0; q < g*g; q++)
+			start[q+1] += start[q];
+		for (int i = 0; i < n; i++) // (start is shifted by one cell)
+		{
+			int p = start[cell[i]]++;
+			soa[p] = xy[2*i+0];
+			soa[n+p] = xy[2*i+1];
+		}
+		for (int q = g*g; q > 0; q--)
+			start[q] = start[q-1];
+		start[0] = 0;
+	}
+	free(cell);
+}
+
+static void multiline_grid_free(struct multiline_grid *G)
+{
+	for (int o = 0; o < 2; o++)
+	{
+		free(G->start[o]);
+		free(G->soa[o]);
+	}
+}
+
+// number of points of the grid at distance less than max_err of the line
+static int multiline_grid_count(struct multiline_grid *G, float *line, int n,
+		float max_err)
+{
+	float m = 1 / hypot(line[0], line[1]);
+	float a = line[0] * m, b = line[1] * m, c = line[2] * m;
+
+	// walk along the coordinate u, and find the cells across, in v
+	int o = fabs(b) >= fabs(a) ? 0 : 1;
+	float au = o ? b : a, av = o ? a : b;
+	float u0 = o ? G->y0 : G->x0, v0 = o ? G->x0 : G->y0;
+	float hv = max_err / fabs(av); // half height of the band, along v
+	int g = G->g, cx = 0;
+	for (int iu = 0; iu < g; iu++)
+	{
+		float ua = u0 + iu * G->cs, ub = ua + G->cs;
+		float va = -(au*ua + c) / av, vb = -(au*ub + c) / av;
+		float fj0 = floor((fmin(va, vb) - hv - v0) / G->cs);
+		float fj1 = floor((fmax(va, vb) + hv - v0) / G->cs);
+		if (!(fj0 < g && fj1 >= 0)) continue;
+		int j0 = fmax(0, fj0), j1 = fmin(g - 1, fj1);
+		int p0 = G->start[o][iu*g+j0], p1 = G->start[o][iu*g+j1+1];
+		for (int p = p0; p < p1; p += 256)
+		{
+			float err[256];
+			int r = p1 - p < 256 ? p1 - p : 256;
+			distance_of_points_to_straight_line(err, line,
+					G->soa[o] + p, n, r, NULL);
+			for (int q = 0; q < r; q++)
+				cx += err[q] < max_err;
+		}
+	}
+	return cx;
+}
+
+// inliers of the line among the points not yet labeled
+static int multiline_inliers(int *out_idx, float *line, float *xy, int n,
+		int *label, float max_err)
+{
+	int m = 0;
+	for (int i = 0; i < n; i++)
+		if (label[i] < 0 && distance_of_point_to_straight_line(line,
+					xy + 2*i, NULL) < max_err)
+			out_idx[m++] = i;
+	return m;
+}
+
+// number of hypotheses that the pool needs before the best one, with "k"
+// inliers, can be trusted (all of them, "max_trials", when the confidence is
+// 0)
+static int multiline_needed_trials(struct ransac_options *o,
+		struct sampler *s, int *mask, float *line, int k, float *xy,
+		float max_err, int max_trials)
+{
+	if (!(o->confidence > 0))
+		return max_trials;
+	return ransac_needed_trials(o, s, mask, line, k, xy, 2, max_err,
+			distance_of_point_to_straight_line, NULL, 1, 0.05,
+			max_trials);
+}
+
+// number of hypotheses drawn among the last "epoch_n" points that are as
+// likely to contain a pair of the "k" inliers of a line as the whole pool of
+// "nt" hypotheses, those from trial epoch_t[e] on drawn among epoch_n[e] points
+static double multiline_equivalent_trials(int *epoch_t, int *epoch_n,
+		int nepochs, int nt, int k)
+{
+	int e1 = nepochs - 1;
+	double r = nt - epoch_t[e1];
+	if (k < 1)
+		return r;
+	double l1 = log1p(-fmin(pow(k / (double)epoch_n[e1], 2), 1 - 1e-9));
+	for (int e = 0; e < e1; e++)
+	{
+		double p = pow(k / (double)epoch_n[e], 2);
+		r += (epoch_t[e+1] - epoch_t[e]) * log1p(-p) / l1;
+	}
+	return r;
+}
+
+// API: find up to "max_lines" lines with at least "min_inliers" inliers each
+// "out_lines" gets the coefficients (a,b,c) of each line, by decreasing
+// number of inliers, and "out_label" the index of the line of each point (or
+// -1 for the points that belong to no line)
+// The options "opt" (optional) are those of ransac: the sampler of the
+// hypotheses (PROSAC with the "quality" of the points, or NAPSAC), their seed,
+// and the confidence.  The pool grows by chunks, and the best hypothesis is
+// extracted (or the extraction stops, if it has too few inliers) once the
+// pool is large enough to trust it at this confidence, as the adaptive stop
+// of ransac, but with at most "ntrials" hypotheses drawn after each extracted
+// line.  The hypotheses drawn before an extraction, among more points, count
+// as fewer hypotheses drawn among the remaining ones.  Then "opt->ntrials"
+// gets the size of the pool.
+// returns the number of lines found
+int multiline_extract(float *out_lines, int *out_label, int max_lines,
+		float *xy, int n, int ntrials, int min_inliers, float max_err,
+		struct ransac_options *opt)
+{
+	struct ransac_options o = opt ? *opt : (struct ransac_options){0};
+	for (int i = 0; i < n; i++)
+		out_label[i] = -1;
+	if (opt)
+		opt->ntrials = 0;
+	if (n < 2 || ntrials < 1 || max_lines < 1)
+		return 0;
+
+	struct sampler s[1];
+	float *quality = o.quality;
+	float *rest_quality = quality ? xmalloc_float(n) : NULL;
+	o.quality = rest_quality;
+	int cap = (max_lines + 1) * ntrials;
+	float *hyp = xmalloc_float(3 * cap);
+	int *count = xmalloc_int(cap);
+	int epoch_t[max_lines + 1], epoch_n[max_lines + 1], nepochs = 0;
+	int *idx = xmalloc_int(n);
+	float *tmp = xmalloc_float(2 * n);
+	float *rest = xmalloc_float(2 * n);
+	struct multiline_grid G[1] = {{0}};
+	int nt = 0;        // size of the pool
+	int base = 0;      // size of the pool at the last extracted line
+	int nrest = -1;    // points of the grid (-1 = to be built)
+	int nlines = 0;
+	bool sampled = false; // whether "s" is initialized
+	bool done = false;
+	while (!done && nlines < max_lines)
+	{
+		// grid and sampler of the points not yet labeled
+		if (nrest < 0) {
+			nrest = 0;
+			for (int i = 0; i < n; i++)
+				if (out_label[i] < 0)
+				{
+					rest[2*nrest+0] = xy[2*i+0];
+					rest[2*nrest+1] = xy[2*i+1];
+					if (quality)
+						rest_quality[nrest] = quality[i];
+					nrest += 1;
+				}
+			if (nrest < min_inliers || nrest < 2)
+				break;
+			multiline_grid_free(G);
+			multiline_grid_init(G, rest, nrest);
+			if (sampled)
+				sampler_free(s);
+			ransac_sampler_init(s, &o, rest, 2, nrest, 2, ntrials,
+					1);
+			sampled = true;
+			epoch_t[nepochs] = base;
+			epoch_n[nepochs] = nrest;
+			nepochs += 1;
+		}
+
+		// draw a new chunk of hypotheses, and count their inliers
+		int t0 = nt;
+		nt = fmin(base + ntrials, nt + MULTILINE_CHUNK);
+		for (int t = t0; t < nt; t++)
+		{
+			struct random_state g[1];
+			random_seed_stream(g, o.seed, t);
+			int i[2];
+			sampler_draw(s, 0, g, t - base, i);
+			float p[4] = {rest[2*i[0]], rest[2*i[0]+1],
+				rest[2*i[1]], rest[2*i[1]+1]};
+			count[t] = straight_line_through_two_points(hyp + 3*t,
+					p, NULL) ? 0 : -1;
+		}
+#pragma omp parallel for schedule(dynamic, 16)
+		for (int t = t0; t < nt; t++)
+			if (count[t] >= 0)
+				count[t] = multiline_grid_count(G, hyp + 3*t,
+						nrest, max_err);
+
+		// extract the lines, from the hypothesis with most inliers, while
+		// the pool is large enough to trust it
+		while (nlines < max_lines)
+		{
+			int best = -1;
+			for (int t = 0; t < nt; t++)
+				if (count[t] >= 0
+					&& (best < 0 || count[t] > count[best]))
+					best = t;
+			if (best < 0) {
+				done = nt >= base + ntrials;
+				break;
+			}
+			if (nrest < 0 || (nt < base + ntrials
+					&& multiline_equivalent_trials(epoch_t,
+						epoch_n, nepochs, nt, count[best])
+					< multiline_needed_trials(&o, s, idx,
+						hyp + 3*best, count[best], rest,
+						max_err, INT_MAX)))
+				break;
+			if (count[best] < min_inliers) {
+				done = true;
+				break;
+			}
+
+			// refit the line to its inliers (while they do not decrease)
+			float line[3] = {hyp[3*best], hyp[3*best+1], hyp[3*best+2]};
+			int m = multiline_inliers(idx, line, xy, n, out_label,
+					max_err);
+			for (int it = 0; it < 3; it++)
+			{
+				for (int k = 0; k < m; k++)
+				{
+					tmp[2*k+0] = xy[2*idx[k]+0];
+					tmp[2*k+1] = xy[2*idx[k]+1];
+				}
+				float refit[3];
+				if (!straight_line_by_total_least_squares(refit,
+							tmp, m, NULL))
+					break;
+				int cx = 0;
+				for (int i = 0; i < n; i++)
+					cx += out_label[i] < 0 && max_err >
+						distance_of_point_to_straight_line(
+							refit, xy + 2*i, NULL);
+				if (cx < m)
+					break;
+				for (int l = 0; l < 3; l++)
+					line[l] = refit[l];
+				m = multiline_inliers(idx, line, xy, n,
+						out_label, max_err);
+			}
+			if (m < min_inliers) { // (the hypothesis lost its inliers)
+				count[best] = -1;
+				continue;
+			}
+
+			// remove its inliers
+			for (int k = 0; k < m; k++)
+			{
+				out_label[idx[k]] = nlines;
+				tmp[k] = xy[2*idx[k]+0];
+				tmp[m+k] = xy[2*idx[k]+1];
+			}
+			for (int l = 0; l < 3; l++)
+				out_lines[3*nlines+l] = line[l];
+			nlines += 1;
+			base = nt;
+			nrest = -1;
+
+			// update the counts of the other hypotheses
+#pragma omp parallel for schedule(dynamic, 16)
+			for (int t = 0; t < nt; t++)
+			{
+				if (count[t] <= 0) continue;
+				float err[256];
+				for (int k0 = 0; k0 < m; k0 += 256)
+				{
+					int r = m - k0 < 256 ? m - k0 : 256;
+					distance_of_points_to_straight_line(err,
+						hyp + 3*t, tmp + k0, m, r, NULL);
+					for (int q = 0; q < r; q++)
+						count[t] -= err[q] < max_err;
+				}
+			}
+			count[best] = -1;
+		}
+	}
+
+	if (opt)
+		opt->ntrials = nt;
+	multiline_grid_free(G);
+	if (sampled)
+		sampler_free(s);
+	free(rest_quality);
+	free(rest);
+	free(tmp);
+	free(idx);
+	free(count);
+	free(hyp);
+	return nlines;
+}
+
+#endif//_MULTILINE_C
@@ -0,0 +1,185 @@
+// compare the extraction of several lines from a shared pool with the
+// sequential ransac runs (one for each line, removing its inliers)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ransac.c"
+#include "ransac_models.c"
+#include "multiline.c"
+#include "pickopt.c"
+#include "seconds.c"
+
+static float random_float(void)
+{
+	return rand() / (RAND_MAX + 1.0);
+}
+
+// random points in a w*h frame, "m" of them near each of "nlines" random
+// lines, and random qualities (for PROSAC)
+static void fill_frame(float *xy, float *quality, int n, int nlines, int m,
+		float w, float h, float noise)
+{
+	int k = 0;
+	for (int l = 0; l < nlines; l++)
+	{
+		float x0 = w * random_float(), y0 = h * random_float();
+		float a = 3.1416 * random_float(), dx = cos(a), dy = sin(a);
+		for (int i = 0; i < m && k < n; i++)
+		{
+			float t = (w + h) * (random_float() - 0.5);
+			float x = x0 + t*dx + noise * (2*random_float() - 1);
+			float y = y0 + t*dy + noise * (2*random_float() - 1);
+			if (x < 0 || y < 0 || x >= w || y >= h) { i--; continue; }
+			xy[2*k+0] = x;
+			xy[2*k+1] = y;
+			k += 1;
+		}
+	}
+	for (; k < n; k++)
+	{
+		xy[2*k+0] = w * random_float();
+		xy[2*k+1] = h * random_float();
+	}
+	for (int i = 0; i < n; i++)
+		quality[i] = random_float();
+}
+
+static int global_sampler = SAMPLER_FLOYD;
+
+// options of the line ransac of camflow
+static struct ransac_options line_options(float *quality)
+{
+	struct ransac_options o = {
+		.confidence = 0.99,
+		.min_trials = 10,
+		.sprt = true,
+		.batch_error = distance_of_points_to_straight_line,
+		.sampler = global_sampler,
+		.quality = quality,
+		.napsac_global = 0.1,
+		.refine = straight_line_by_total_least_squares };
+	return o;
+}
+
+// one ransac run for each line, on the points not yet labeled
+static int sequential_lines(int *label, float *xy, float *quality, int n,
+		int max_lines, int ntrials, int min_inliers, float max_err,
+		int *out_ntrials)
+{
+	int *idx = xmalloc_int(n), *mask = xmalloc_int(n), m = n, nlines = 0;
+	float *rxy = xmalloc_float(2 * n), *rq = xmalloc_float(n);
+	for (int i = 0; i < n; i++)
+	{
+		label[i] = -1;
+		idx[i] = i;
+	}
+	*out_ntrials = 0;
+	while (nlines < max_lines && m >= 2)
+	{
+		for (int k = 0; k < m; k++)
+		{
+			rxy[2*k+0] = xy[2*idx[k]+0];
+			rxy[2*k+1] = xy[2*idx[k]+1];
+			rq[k] = quality[idx[k]];
+		}
+		struct ransac_options o = line_options(rq);
+		float line[3];
+		int r = ransac_opt(mask, line, rxy, 2, m, 3,
+				distance_of_point_to_straight_line,
+				straight_line_through_two_points,
+				2, ntrials, 3, max_err, NULL, NULL, &o);
+		*out_ntrials += o.ntrials;
+		if (r < min_inliers)
+			break;
+		int cx = 0;
+		for (int k = 0; k < m; k++)
+			if (mask[k])
+				label[idx[k]] = nlines;
+			else
+				idx[cx++] = idx[k];
+		m = cx;
+		nlines += 1;
+	}
+	free(rq);
+	free(rxy);
+	free(mask);
+	free(idx);
+	return nlines;
+}
+
+static void print_result(char *name, double t, int nframes, int nlines,
+		int nlabeled, long ntrials)
+{
+	printf("%-12s %8.2f lines %8.1f labeled %8ld trials %10.3f ms\n",
+			name, nlines / (double)nframes,
+			nlabeled / (double)nframes, ntrials / nframes,
+			1000 * t / nframes);
+}
+
+int main(int c, char *v[])
+{
+	// extract named options
+	int n = atoi(pick_option(&c, &v, "n", "450"));
+	int nlines = atoi(pick_option(&c, &v, "l", "3"));
+	int m = atoi(pick_option(&c, &v, "m", "50"));
+	int ntrials = atoi(pick_option(&c, &v, "t", "300"));
+	int min_inliers = atoi(pick_option(&c, &v, "i", "22"));
+	float max_err = atof(pick_option(&c, &v, "e", "1.5"));
+	int nframes = atoi(pick_option(&c, &v, "f", "50"));
+	char *sampler = pick_option(&c, &v, "s", "floyd");
+	if (c != 1)
+		return fprintf(stderr, "usage:\n\t%s [-n npoints] [-l nlines] "
+				"[-m points_per_line] [-t ntrials] [-i minliers] "
+				"[-e max_err] [-f nframes] "
+				"[-s floyd|prosac|napsac]\n", *v);
+	if (!strcmp(sampler, "prosac")) global_sampler = SAMPLER_PROSAC;
+	if (!strcmp(sampler, "napsac")) global_sampler = SAMPLER_NAPSAC;
+
+	int max_lines = 10;
+	float *xy = xmalloc_float(2 * n * nframes);
+	float *quality = xmalloc_float(n * nframes);
+	int *label = xmalloc_int(n);
+	float line[3*max_lines];
+	srand(1);
+	for (int f = 0; f < nframes; f++)
+		fill_frame(xy + 2*n*f, quality + n*f, n, nlines, m, 640, 480,
+				0.5);
+	printf("%d points, %d lines of %d points, %d trials, %d frames, %s\n",
+			n, nlines, m, ntrials, nframes, sampler);
+
+	for (int method = 0; method < 3; method++)
+	{
+		char *name[] = {"sequential", "pool", "pool, c=0"};
+		long found = 0, nlabeled = 0, nt = 0;
+		double t = seconds();
+		for (int f = 0; f < nframes; f++)
+		{
+			float *fxy = xy + 2*n*f, *fq = quality + n*f;
+			int r, used;
+			if (method == 0) {
+				r = sequential_lines(label, fxy, fq, n, max_lines,
+						ntrials, min_inliers, max_err,
+						&used);
+			} else {
+				struct ransac_options o = line_options(fq);
+				if (method == 2)
+					o.confidence = 0;
+				r = multiline_extract(line, label, max_lines,
+						fxy, n, ntrials, min_inliers,
+						max_err, &o);
+				used = o.ntrials;
+			}
+			found += r;
+			nt += used;
+			for (int i = 0; i < n; i++)
+				nlabeled += label[i] >= 0;
+		}
+		print_result(name[method], seconds() - t, nframes, found,
+				nlabeled, nt);
+	}
+
+	free(label);
+	free(quality);
+	free(xy);
+	return 0;
+}
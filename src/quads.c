@@ -0,0 +1,545 @@
+// recognition of constellations by quads in a k-d tree (as astrometry.net)
+//
+// A quad is a set of four nearby dots.  Its two most distant dots A and B
+// define a frame where A is at (0,0) and B at (1,1), and the code of the quad
+// is the coordinates (xc, yc, xd, yd) of the two other dots C and D in this
+// frame.  The code is invariant to similarities, and since the quads are
+// small, it is only slightly changed by the perspective or the bending of a
+// label.  The symmetries of the code are broken by swapping A and B so that
+// xc + xd <= 1, and C and D so that xc <= xd.
+//
+// The codes of the catalog are stored in a static k-d tree, whose nodes are
+// implicit: the node i has the children 2i+1 and 2i+2, and it splits its
+// range of codes at the middle, so that the tree only stores the split
+// dimension and value of each node, and the codes sorted in the order of the
+// leaves.  The whole tree is a single block of memory, which is written as it
+// is by "quads_save" and mapped by "quads_load" (see mapblock.c).
+//
+// Online, the quads of the keypoints of the frame are formed in the same way
+// and their codes are searched in the tree within a radius.  Each code found
+// votes for the four correspondences of its quad, and the constellations
+// with most votes are verified by ransac of a homography (as in
+// constellation.c).
+
+#ifndef _QUADS_C
+#define _QUADS_C
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fail.c"
+#include "xmalloc.c"
+#include "mapblock.c"
+#include "constellation.c"
+
+#define QUADS_MAGIC "QUADTRE1"
+#define QUADS_LEAF 8      // maximum number of codes of a leaf
+#define QUADS_MAX_DEPTH 28
+
+struct quads_node {
+	float split;        // value of the split
+	int32_t dim;        // dimension of the split
+};
+
+// a quad of the catalog
+struct quads_quad {
+	int32_t label;      // constellation
+	int32_t v[4];       // its dots A, B, C, D
+};
+
+// beginning of the block (and of the file)
+struct quads_header {
+	char magic[8];
+	int32_t nlabels;    // number of constellations
+	int32_t ndots;      // number of dots of all the constellations
+	int32_t nquads;     // number of quads
+	int32_t depth;      // number of levels of internal nodes
+	int32_t k;          // neighbors of each dot used to form the quads
+	float radius;       // default radius of the searches
+	int64_t off_start;  // offsets (in bytes from the beginning) of the arrays
+	int64_t off_xy;
+	int64_t off_node;
+	int64_t off_code;
+	int64_t off_quad;
+	int64_t size;       // size of the block
+};
+
+struct quads_index {
+	struct quads_header *h;
+	int32_t *start;     // first dot of each constellation (and nlabels+1)
+	float *xy;          // coordinates of the dots
+	struct quads_node *node; // internal nodes, 2^depth - 1
+	float *code;        // codes, 4 by quad, in the order of the leaves
+	struct quads_quad *quad; // quads, in the same order
+	bool mapped;        // whether the block is a mapped file
+};
+
+// code of the quad of the points i[4], and its dots in canonical order
+// returns false when the order is unstable (two pairs of nearly the same
+// length for the most distant one, or a code near a symmetry)
+static bool quads_code(float code[4], int v[4], float *xy, int i[4],
+		float tol)
+{
+	int a = 0, b = 1;
+	float l = -1, l2 = -1; // the two largest distances
+	for (int p = 0; p < 4; p++)
+	for (int q = p + 1; q < 4; q++)
+	{
+		float *P = xy + 2*i[p], *Q = xy + 2*i[q];
+		float d = hypot(P[0] - Q[0], P[1] - Q[1]);
+		if (d > l) {
+			l2 = l;
+			l = d;
+			a = p;
+			b = q;
+		} else if (d > l2)
+			l2 = d;
+	}
+	if (!(l > 0) || l - l2 < tol * l)
+		return false;
+	int c = 0;
+	while (c == a || c == b) c += 1;
+	int e = 6 - a - b - c;
+
+	// frame of A and B: z' = (z - A) * (1+i) / (B - A)
+	float *A = xy + 2*i[a], *B = xy + 2*i[b];
+	float ex = B[0] - A[0], ey = B[1] - A[1], e2 = ex*ex + ey*ey;
+	float u[2], w[2];
+	for (int j = 0; j < 2; j++)
+	{
+		float *C = xy + 2*i[j ? e : c];
+		float dx = C[0] - A[0], dy = C[1] - A[1];
+		float x = (ex*dx + ey*dy) / e2, y = (ex*dy - ey*dx) / e2;
+		u[j] = x - y;
+		w[j] = x + y;
+	}
+	if (fabs(u[0] + u[1] - 1) < tol || fabs(u[0] - u[1]) < tol)
+		return false;
+	v[0] = i[a]; v[1] = i[b]; v[2] = i[c]; v[3] = i[e];
+	if (u[0] + u[1] > 1) { // swap A and B: z' -> (1+i) - z'
+		for (int j = 0; j < 2; j++)
+		{
+			u[j] = 1 - u[j];
+			w[j] = 1 - w[j];
+		}
+		v[0] = i[b]; v[1] = i[a];
+	}
+	int s = u[0] > u[1]; // swap C and D
+	code[0] = u[s];
+	code[1] = w[s];
+	code[2] = u[!s];
+	code[3] = w[!s];
+	if (s) { int t = v[2]; v[2] = v[3]; v[3] = t; }
+	return true;
+}
+
+// call "f" on the quads formed by each point and three of its "k" neighbors
+static void quads_enumerate(float *xy, int n, int *nb, int k, float tol,
+		void (*f)(float code[4], int v[4], void *), void *usr)
+{
+	for (int p = 0; p < n; p++)
+	{
+		int *N = nb + k*p;
+		for (int a = 0; a < k && N[a] >= 0; a++)
+		for (int b = a + 1; b < k && N[b] >= 0; b++)
+		for (int c = b + 1; c < k && N[c] >= 0; c++)
+		{
+			int i[4] = {p, N[a], N[b], N[c]}, v[4];
+			float code[4];
+			if (quads_code(code, v, xy, i, tol))
+				f(code, v, usr);
+		}
+	}
+}
+
+// set the pointers to the arrays of the block
+static void quads_set_arrays(struct quads_index *qi)
+{
+	char *b = (char *)qi->h;
+	qi->start = (int32_t *)(b + qi->h->off_start);
+	qi->xy = (float *)(b + qi->h->off_xy);
+	qi->node = (struct quads_node *)(b + qi->h->off_node);
+	qi->code = (float *)(b + qi->h->off_code);
+	qi->quad = (struct quads_quad *)(b + qi->h->off_quad);
+}
+
+// quads of the catalog, while they are collected
+struct quads_list {
+	int n, cap, label, offset;
+	float *code;
+	struct quads_quad *quad;
+};
+
+static void quads_collect(float code[4], int v[4], void *usr)
+{
+	struct quads_list *L = usr;
+	if (L->n == L->cap) {
+		L->cap *= 2;
+		L->code = realloc(L->code, 4 * L->cap * sizeof*L->code);
+		L->quad = realloc(L->quad, L->cap * sizeof*L->quad);
+		if (!L->code || !L->quad) fail("quads_build: out of memory");
+	}
+	for (int j = 0; j < 4; j++)
+	{
+		L->code[4*L->n+j] = code[j];
+		L->quad[L->n].v[j] = L->offset + v[j];
+	}
+	L->quad[L->n].label = L->label;
+	L->n += 1;
+}
+
+static int compare_quads_quads(const void *aa, const void *bb)
+{
+	const int32_t *a = ((const struct quads_quad *)aa)->v;
+	const int32_t *b = ((const struct quads_quad *)bb)->v;
+	for (int j = 0; j < 4; j++)
+		if (a[j] != b[j])
+			return (a[j] > b[j]) - (a[j] < b[j]);
+	return 0;
+}
+
+// move the median of dimension "d" of the codes perm[lo] ... perm[hi-1] to
+// perm[mid], with the smaller ones before it and the larger ones after it
+static void quads_select(int *perm, float *code, int lo, int hi, int mid,
+		int d)
+{
+	while (hi - lo > 1)
+	{
+		float pivot = code[4*perm[(lo + hi) / 2] + d];
+		int i = lo, j = hi - 1;
+		while (i <= j)
+		{
+			while (code[4*perm[i] + d] < pivot) i += 1;
+			while (code[4*perm[j] + d] > pivot) j -= 1;
+			if (i <= j) {
+				int t = perm[i]; perm[i] = perm[j]; perm[j] = t;
+				i += 1;
+				j -= 1;
+			}
+		}
+		if (mid <= j) hi = j + 1;
+		else if (mid >= i) lo = i;
+		else return;
+	}
+}
+
+// split the codes perm[lo] ... perm[hi-1] at the node i, along their widest
+// dimension
+static void quads_split(struct quads_node *node, int depth, int i, int level,
+		int *perm, float *code, int lo, int hi)
+{
+	if (level == depth)
+		return;
+	float m[4], M[4];
+	for (int d = 0; d < 4; d++)
+	{
+		m[d] = INFINITY;
+		M[d] = -INFINITY;
+	}
+	for (int p = lo; p < hi; p++)
+	for (int d = 0; d < 4; d++)
+	{
+		m[d] = fmin(m[d], code[4*perm[p]+d]);
+		M[d] = fmax(M[d], code[4*perm[p]+d]);
+	}
+	int dim = 0;
+	for (int d = 1; d < 4; d++)
+		if (M[d] - m[d] > M[dim] - m[dim])
+			dim = d;
+	int mid = lo + (hi - lo) / 2;
+	if (mid < hi)
+		quads_select(perm, code, lo, hi, mid, dim);
+	node[i].dim = dim;
+	node[i].split = mid < hi ? code[4*perm[mid]+dim] : 0;
+	quads_split(node, depth, 2*i+1, level+1, perm, code, lo, mid);
+	quads_split(node, depth, 2*i+2, level+1, perm, code, mid, hi);
+}
+
+// API: index the quads of the "nlabels" constellations given by their dots
+// (with the same arguments as "constellation_index_build"), "radius" is the
+// default radius of the searches of codes (for example 0.02)
+void quads_build(struct quads_index *qi, float *xy, int *start, int nlabels,
+		int k, float radius)
+{
+	if (k < 3 || k > CONSTELLATION_MAX_K)
+		fail("quads_build: bad number of neighbors %d", k);
+	if (!(radius > 0))
+		fail("quads_build: bad radius %g", radius);
+
+	// the quads of all the constellations
+	struct quads_list L[1] = {{.cap = 1024}};
+	L->code = xmalloc_float(4 * L->cap);
+	L->quad = xmalloc(L->cap * sizeof*L->quad);
+	for (int l = 0; l < nlabels; l++)
+	{
+		int m = start[l+1] - start[l];
+		int *nb = xmalloc_int(k * (m ? m : 1));
+		constellation_neighbors(nb, xy + 2*start[l], m, k);
+		L->label = l;
+		L->offset = start[l];
+		int n0 = L->n;
+		quads_enumerate(xy + 2*start[l], m, nb, k, radius / 2,
+				quads_collect, L);
+		free(nb);
+
+		// remove the repeated ones (formed from several dots), whose
+		// codes are the same
+		int *perm = xmalloc_int(L->n - n0 + 1);
+		struct quads_quad *q = L->quad + n0;
+		float *c = xmalloc_float(4 * (L->n - n0) + 1);
+		for (int i = n0; i < L->n; i++)
+		for (int j = 0; j < 4; j++)
+			c[4*(i-n0)+j] = L->code[4*i+j];
+		for (int i = 0; i < L->n - n0; i++)
+			q[i].label = i; // (temporarily, the index of the code)
+		qsort(q, L->n - n0, sizeof*q, compare_quads_quads);
+		int nu = 0;
+		for (int i = 0; i < L->n - n0; i++)
+			if (!nu || compare_quads_quads(q + nu - 1, q + i))
+				perm[nu++] = i;
+		for (int i = 0; i < nu; i++)
+		{
+			int o = q[perm[i]].label;
+			q[i] = q[perm[i]];
+			q[i].label = l;
+			for (int j = 0; j < 4; j++)
+				L->code[4*(n0+i)+j] = c[4*o+j];
+		}
+		L->n = n0 + nu;
+		free(c);
+		free(perm);
+	}
+	int n = L->n;
+
+	// the block
+	int ndots = start[nlabels], depth = 0;
+	while (depth < QUADS_MAX_DEPTH && ((long)n >> depth) > QUADS_LEAF)
+		depth += 1;
+	int nnodes = (1 << depth) - 1;
+	struct quads_header h = {QUADS_MAGIC, nlabels, ndots, n, depth, k,
+		radius, 0, 0, 0, 0, 0, 0};
+	h.off_start = mapblock_align(sizeof h);
+	h.off_xy = mapblock_align(h.off_start + (nlabels+1) * sizeof(int32_t));
+	h.off_node = mapblock_align(h.off_xy + 2 * ndots * sizeof(float));
+	h.off_code = mapblock_align(h.off_node
+			+ nnodes * sizeof(struct quads_node));
+	h.off_quad = mapblock_align(h.off_code + 4 * n * sizeof(float));
+	h.size = mapblock_align(h.off_quad + n * sizeof(struct quads_quad));
+	qi->h = mapblock_alloc(h.size);
+	*qi->h = h;
+	qi->mapped = false;
+	quads_set_arrays(qi);
+	for (int l = 0; l <= nlabels; l++)
+		qi->start[l] = start[l];
+	memcpy(qi->xy, xy, 2 * ndots * sizeof*xy);
+
+	// the tree, and the codes in the order of its leaves
+	int *perm = xmalloc_int(n + 1);
+	for (int i = 0; i < n; i++)
+		perm[i] = i;
+	quads_split(qi->node, depth, 0, 0, perm, L->code, 0, n);
+	for (int i = 0; i < n; i++)
+	{
+		for (int j = 0; j < 4; j++)
+			qi->code[4*i+j] = L->code[4*perm[i]+j];
+		qi->quad[i] = L->quad[perm[i]];
+	}
+	free(perm);
+	free(L->code);
+	free(L->quad);
+}
+
+// API: write the index to a file
+void quads_save(struct quads_index *qi, char *filename)
+{
+	mapblock_save(qi->h, qi->h->size, filename);
+}
+
+// API: map an index written by "quads_save"
+void quads_load(struct quads_index *qi, char *filename)
+{
+	qi->h = mapblock_load(filename, QUADS_MAGIC, sizeof*qi->h,
+			offsetof(struct quads_header, off_start), 5);
+	qi->mapped = true;
+	struct quads_header *h = qi->h;
+	int64_t *off = &h->off_start;
+	if (h->depth < 0 || h->depth > QUADS_MAX_DEPTH
+			|| !mapblock_fits(off, 0, (h->nlabels + 1L)
+				* sizeof*qi->start)
+			|| !mapblock_fits(off, 1, 2L * h->ndots * sizeof*qi->xy)
+			|| !mapblock_fits(off, 2, ((1L << h->depth) - 1)
+				* sizeof*qi->node)
+			|| !mapblock_fits(off, 3, 4L * h->nquads * sizeof*qi->code)
+			|| !mapblock_fits(off, 4, (long)h->nquads
+				* sizeof*qi->quad))
+		fail("quads_load: \"%s\" is not an index of quads", filename);
+	quads_set_arrays(qi);
+}
+
+// API
+void quads_free(struct quads_index *qi)
+{
+	mapblock_free(qi->h, qi->h->size, qi->mapped);
+}
+
+static float quads_distance2(float *a, float *b)
+{
+	float r = 0;
+	for (int d = 0; d < 4; d++)
+		r += (a[d] - b[d]) * (a[d] - b[d]);
+	return r;
+}
+
+static int quads_search_node(struct quads_index *qi, float code[4], float r,
+		int i, int level, int lo, int hi,
+		void (*f)(struct quads_quad *, void *), void *usr)
+{
+	if (level == qi->h->depth) {
+		int cx = 0;
+		for (int p = lo; p < hi; p++)
+			if (quads_distance2(qi->code + 4*p, code) <= r * r)
+			{
+				f(qi->quad + p, usr);
+				cx += 1;
+			}
+		return cx;
+	}
+	struct quads_node *N = qi->node + i;
+	int mid = lo + (hi - lo) / 2, cx = 0;
+	if (code[N->dim] - r <= N->split)
+		cx += quads_search_node(qi, code, r, 2*i+1, level+1, lo, mid,
+				f, usr);
+	if (code[N->dim] + r >= N->split)
+		cx += quads_search_node(qi, code, r, 2*i+2, level+1, mid, hi,
+				f, usr);
+	return cx;
+}
+
+// API: call "f" on each quad of the index whose code is at distance at most
+// "r" of the given code
+// returns the number of quads found
+int quads_search(struct quads_index *qi, float code[4], float r,
+		void (*f)(struct quads_quad *, void *), void *usr)
+{
+	return quads_search_node(qi, code, r, 0, 0, 0, qi->h->nquads, f, usr);
+}
+
+static void quads_nearest_node(struct quads_index *qi, float code[4],
+		int i, int level, int lo, int hi, int *best, float *best_d2)
+{
+	if (level == qi->h->depth) {
+		for (int p = lo; p < hi; p++)
+		{
+			float d2 = quads_distance2(qi->code + 4*p, code);
+			if (d2 < *best_d2) {
+				*best_d2 = d2;
+				*best = p;
+			}
+		}
+		return;
+	}
+	struct quads_node *N = qi->node + i;
+	int mid = lo + (hi - lo) / 2;
+	float t = code[N->dim] - N->split;
+	if (t <= 0) { // (the nearest side first)
+		quads_nearest_node(qi, code, 2*i+1, level+1, lo, mid,
+				best, best_d2);
+		if (t * t < *best_d2)
+			quads_nearest_node(qi, code, 2*i+2, level+1, mid, hi,
+					best, best_d2);
+	} else {
+		quads_nearest_node(qi, code, 2*i+2, level+1, mid, hi,
+				best, best_d2);
+		if (t * t < *best_d2)
+			quads_nearest_node(qi, code, 2*i+1, level+1, lo, mid,
+					best, best_d2);
+	}
+}
+
+// API: quad of the index with the nearest code, at distance less than "r"
+// returns NULL if there is none
+struct quads_quad *quads_nearest(struct quads_index *qi, float code[4],
+		float r, float *out_distance)
+{
+	int best = -1;
+	float best_d2 = r * r;
+	quads_nearest_node(qi, code, 0, 0, 0, qi->h->nquads, &best, &best_d2);
+	if (out_distance)
+		*out_distance = best < 0 ? INFINITY : sqrt(best_d2);
+	return best < 0 ? NULL : qi->quad + best;
+}
+
+// state of "quads_matching" while it searches the quads of the frame
+struct quads_frame {
+	struct quads_index *qi;
+	int v[4];           // the quad of the frame, in canonical order
+	uint64_t ndots;
+	int *nquads, *npairs; // votes of each constellation
+	int *voted, nvoted;   // constellations with votes
+	struct constellation_votes V[1];
+};
+
+// vote for the correspondences of a quad of the index
+static void quads_vote(struct quads_quad *q, void *usr)
+{
+	struct quads_frame *F = usr;
+	int l = q->label;
+	if (!F->nquads[l]++)
+		F->voted[F->nvoted++] = l;
+	for (int j = 0; j < 4; j++)
+		F->npairs[l] += 1 == constellation_votes_add(F->V,
+				1 + F->v[j]*F->ndots + q->v[j], l);
+}
+
+static void quads_search_frame(float code[4], int v[4], void *usr)
+{
+	struct quads_frame *F = usr;
+	for (int j = 0; j < 4; j++)
+		F->v[j] = v[j];
+	quads_search(F->qi, code, F->qi->h->radius, quads_vote, F);
+}
+
+// API: recognize one of the indexed constellations among the points "xy"
+// (with the same arguments as "constellation_matching")
+// The quads of the frame are formed with the "k" nearest neighbors of each
+// point, and their codes are searched in the tree within the radius of the
+// index.  The constellations with most quads found are verified by a
+// homography on the correspondences voted by the quads.
+// returns the number of inliers (0 if no constellation was recognized)
+int quads_matching(struct constellation_match *out, struct quads_index *qi,
+		float *xy, int n, int k,
+		int ncandidates, float max_err, int min_inliers, uint64_t seed)
+{
+	int nlabels = qi->h->nlabels;
+	out->label = -1;
+	out->nvotes = out->ncorrespondences = out->ninliers = 0;
+	if (k > CONSTELLATION_MAX_K) k = CONSTELLATION_MAX_K;
+	if (n < 4 || k < 3 || nlabels < 1)
+		return 0;
+
+	int *nb = xmalloc_int(k * n);
+	constellation_neighbors(nb, xy, n, k);
+	struct quads_frame F[1] = {{.qi = qi, .ndots = qi->h->ndots}};
+	F->nquads = xmalloc_int(3 * nlabels);
+	F->npairs = F->nquads + nlabels;
+	F->voted = F->npairs + nlabels;
+	memset(F->nquads, 0, 2 * nlabels * sizeof*F->nquads);
+	constellation_votes_init(F->V, 12);
+	quads_enumerate(xy, n, nb, k, qi->h->radius / 2, quads_search_frame,
+			F);
+
+	// verify the constellations with most quads
+	constellation_candidates(out, F->voted, F->nvoted, F->nquads,
+			F->npairs, qi->xy, qi->h->ndots, xy, F->V, ncandidates,
+			max_err, min_inliers, seed);
+
+	free(F->V->t);
+	free(F->nquads);
+	free(nb);
+	return out->ninliers;
+}
+
+#endif//_QUADS_C
@@ -0,0 +1,141 @@
+// compare the recognition of constellations by quads in a k-d tree with the
+// recognition by the hash table of constellation.c, under perspective
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "quads.c"
+#include "constellation_synth.c"
+#include "pickopt.c"
+#include "seconds.c"
+
+// the same as "quads_nearest", by a scan of all the codes
+static int brute_force_nearest(struct quads_index *qi, float code[4], float r)
+{
+	int best = -1;
+	float best_d2 = r * r;
+	for (int i = 0; i < qi->h->nquads; i++)
+	{
+		float d2 = quads_distance2(qi->code + 4*i, code);
+		if (d2 < best_d2) {
+			best_d2 = d2;
+			best = i;
+		}
+	}
+	return best;
+}
+
+// nearest codes of the quads of a frame, by the tree and by brute force (for
+// the first NBRUTE quads, since it is slow)
+#define NBRUTE 1000
+struct nearest_check {
+	struct quads_index *qi;
+	long nquads, nfound;
+	double t_tree, t_brute;
+};
+
+static void check_nearest(float code[4], int v[4], void *usr)
+{
+	(void)v;
+	struct nearest_check *C = usr;
+	float r = C->qi->h->radius;
+	double t = seconds();
+	struct quads_quad *q = quads_nearest(C->qi, code, r, NULL);
+	C->t_tree += seconds() - t;
+	C->nquads += 1;
+	C->nfound += q != NULL;
+	if (C->nquads > NBRUTE) return;
+	t = seconds();
+	int i = brute_force_nearest(C->qi, code, r);
+	C->t_brute += seconds() - t;
+	int j = q ? q - C->qi->quad : -1;
+	if (i != j && (i < 0 || j < 0 || quads_distance2(C->qi->code + 4*i,
+					code) != quads_distance2(C->qi->code
+						+ 4*j, code)))
+		fail("quads_nearest found the quad %d instead of %d", j, i);
+}
+
+int main(int c, char *v[])
+{
+	// extract named options
+	int nlabels = atoi(pick_option(&c, &v, "l", "1000"));
+	int ndots = atoi(pick_option(&c, &v, "d", "60"));
+	int nclutter = atoi(pick_option(&c, &v, "c", "300"));
+	int k = atoi(pick_option(&c, &v, "k", "6"));
+	float radius = atof(pick_option(&c, &v, "t", "0.02"));
+	float persp = atof(pick_option(&c, &v, "p", "0.001"));
+	int nrep = atoi(pick_option(&c, &v, "r", "10"));
+	if (c != 1 && c != 2)
+		return fprintf(stderr, "usage:\n\t%s [-l nlabels] [-d ndots] "
+				"[-c nclutter] [-k neighbors] [-t radius] "
+				"[-p perspective] [-r nrep] [index.qt]\n", *v);
+	char *filename = c == 2 ? v[1] : NULL;
+
+	// random constellations
+	srand(1);
+	int *start = xmalloc_int(nlabels + 1);
+	float *xy = xmalloc_float(2 * nlabels * ndots);
+	synth_constellations(xy, start, nlabels, ndots);
+
+	struct quads_index qi[1];
+	double t = seconds();
+	quads_build(qi, xy, start, nlabels, k, radius);
+	printf("%d constellations of %d dots, %d quads, built in %.1f ms\n",
+			nlabels, ndots, qi->h->nquads, 1000 * (seconds() - t));
+	if (filename) {
+		quads_save(qi, filename);
+		quads_free(qi);
+		t = seconds();
+		quads_load(qi, filename);
+		printf("index of %.1f MB mapped in %.3f ms\n",
+				qi->h->size / 1048576.0, 1000 * (seconds() - t));
+	}
+	struct constellation_index ci[1];
+	constellation_index_build(ci, xy, start, nlabels, k, radius / 2);
+
+	// nearest codes of the first frame, and recognition of all the frames
+	float *f = xmalloc_float(2 * (ndots + nclutter));
+	int kf = k + 2, *nb = xmalloc_int(kf * (ndots + nclutter));
+	struct nearest_check C[1] = {{.qi = qi}};
+	double t_quads = 0, t_hash = 0;
+	int ngood_quads = 0, ngood_hash = 0;
+	for (int r = 0; r < nrep; r++)
+	{
+		int l = rand() % nlabels;
+		float H[9];
+		synth_homography(H, persp);
+		int n = synth_frame(f, qi->xy + 2*qi->start[l],
+				qi->start[l+1] - qi->start[l], H, nclutter);
+		if (!r) {
+			constellation_neighbors(nb, f, n, kf);
+			quads_enumerate(f, n, nb, kf, radius / 2,
+					check_nearest, C);
+		}
+
+		struct constellation_match m[1];
+		t = seconds();
+		quads_matching(m, qi, f, n, kf, 5, 3, 10, r);
+		t_quads += seconds() - t;
+		ngood_quads += m->label == l && m->ninliers > 0;
+		t = seconds();
+		constellation_matching(m, ci, f, n, kf, 5, 3, 10, r);
+		t_hash += seconds() - t;
+		ngood_hash += m->label == l && m->ninliers > 0;
+	}
+	printf("%ld quads by frame, %.1f%% with a code nearer than %g\n",
+			C->nquads, 100.0 * C->nfound / C->nquads, radius);
+	printf("k-d tree    %10.3f us/quad\n", 1e6 * C->t_tree / C->nquads);
+	printf("brute force %10.3f us/quad\n", 1e6 * C->t_brute
+			/ (C->nquads < NBRUTE ? C->nquads : NBRUTE));
+	printf("quads       %d/%d recognized %10.3f ms/frame\n",
+			ngood_quads, nrep, 1000 * t_quads / nrep);
+	printf("hash table  %d/%d recognized %10.3f ms/frame\n",
+			ngood_hash, nrep, 1000 * t_hash / nrep);
+
+	constellation_index_free(ci);
+	quads_free(qi);
+	free(nb);
+	free(f);
+	free(xy);
+	free(start);
+	return 0;
+}
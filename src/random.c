@@ -0,0 +1,80 @@
+// small and fast pseudo-random number generator, with independent streams
+//
+// The generator is xoshiro256** (Blackman and Vigna).  Its state is seeded by
+// the splitmix64 sequence, and each stream is seeded by hashing the user seed
+// together with the stream number, so that the same (seed, stream) always
+// produces the same numbers, whatever thread draws them.
+
+#ifndef _RANDOM_C
+#define _RANDOM_C
+
+#include <stdint.h>
+
+struct random_state {
+	uint64_t s[4];
+};
+
+// step of the splitmix64 sequence
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9e3779b97f4a7c15);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+	return z ^ (z >> 31);
+}
+
+static uint64_t rotl64(uint64_t x, int k)
+{
+	return (x << k) | (x >> (64 - k));
+}
+
+// API: initialize the generator from a seed
+void random_seed(struct random_state *r, uint64_t seed)
+{
+	for (int i = 0; i < 4; i++)
+		r->s[i] = splitmix64(&seed);
+}
+
+// API: initialize the generator on the stream "k" of the given seed
+void random_seed_stream(struct random_state *r, uint64_t seed, uint64_t k)
+{
+	uint64_t x = k;
+	random_seed(r, seed ^ splitmix64(&x));
+}
+
+// API: next 64 random bits
+uint64_t random_uint64(struct random_state *r)
+{
+	uint64_t *s = r->s;
+	uint64_t result = rotl64(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl64(s[3], 45);
+	return result;
+}
+
+// API: uniform random integer in [0, n), for 0 < n < 2^32
+// (multiply and shift, with rejection of the biased values)
+int random_index_below(struct random_state *r, int n)
+{
+	uint32_t m = n;
+	uint64_t p = (random_uint64(r) >> 32) * m;
+	if ((uint32_t)p < m) {
+		uint32_t t = -m % m;
+		while ((uint32_t)p < t)
+			p = (random_uint64(r) >> 32) * m;
+	}
+	return p >> 32;
+}
+
+// API: uniform random number in [0, 1)
+double random_uniform(struct random_state *r)
+{
+	return (random_uint64(r) >> 11) * 0x1.0p-53;
+}
+
+#endif//_RANDOM_C
@@ -1,9 +1,19 @@
+#ifndef _RANSAC_C
+#define _RANSAC_C
+
 #include <assert.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <math.h>
 
 #include "fail.c"
 #include "xmalloc.c"
+#include "random.c"
+#include "sampler.c"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // generic function
 // evaluate the error of a datapoint according to a model
@@ -15,6 +25,21 @@ typedef float (ransac_error_evaluation_function)(
 		);
 
 
+// generic function
+// evaluate the errors of a block of data points according to a model, where
+// the points are given as separate arrays of coordinates (coordinate k of the
+// point i is soa[k*ld + i])
+// (this function is optional, it replaces the error evaluation function to
+// allow vectorized implementations)
+typedef void (ransac_batch_error_function)(
+		float *out_err,    // errors of the n points
+		float *model,
+		float *soa,        // coordinates of the data points
+		int ld,            // distance between coordinate arrays
+		int n,             // number of data points
+		void *usr
+		);
+
 // generic function
 // compute the model defined from a few data points
 // (shall return 0 if no model could be computed)
@@ -25,6 +50,18 @@ typedef int (ransac_model_generating_function)(
 		void *usr
 		);
 
+// generic function
+// compute the model that fits best a set of data points (e.g., by least
+// squares), used to refine a model from its inliers
+// (shall return 0 if no model could be computed)
+// (this function is optional, it enables the local optimization)
+typedef int (ransac_model_refining_function)(
+		float *out_model,  // parameters of the computed model
+		float *data,       // data points
+		int n,             // number of data points
+		void *usr
+		);
+
 // generic function
 // tell whether a given model is good enough (e.g., not severely distorted)
 // (this function is optional, and only serves as an optimization hint)
@@ -69,51 +106,392 @@ int ransac_trial(
 }
 
 // utility function: return a random number in the interval [a, b)
-static int random_index(int a, int b)
+static int random_index(struct random_state *g, int a, int b)
 {
-	int r = a + rand()%(b - a);
+	int r = a + random_index_below(g, b - a);
 	assert(r >= a);
 	assert(r < b);
 	return r;
 }
 
-// comparison function for the qsort call below
-static int compare_ints(const void *aa, const void *bb)
+#define MAX_MODELS 10
+#define RANSAC_BLOCK 256   // points evaluated by each call of batch_error
+#define RANSAC_BATCH 16    // trials run in parallel between reductions
+
+// optional parameters of ransac, and statistics of its last run
+struct ransac_options {
+	// input
+	float confidence;  // probability of drawing an all-inlier sample
+	                   // (0 means that all the trials are always run)
+	int min_trials;    // minimum number of trials, when stopping early
+	bool sprt;         // verify the models by a sequential test
+	float sprt_epsilon;// initial inlier ratio of good models (0 = wait
+	                   // for the first model that is fully verified)
+	float sprt_delta;  // initial inlier ratio of bad models (0 = 0.05)
+	float sprt_tmodel; // cost of a model, in error evaluations (0 = 20)
+	ransac_batch_error_function *batch_error; // (replaces "mev")
+	uint64_t seed;     // seed of the random samples
+	int sampler;       // SAMPLER_FLOYD (default), _SHUFFLE, _PROSAC or _NAPSAC
+	float *quality;    // quality of each data point (needed by PROSAC)
+	float napsac_radius; // size of the neighborhoods (0 = automatic)
+	float napsac_global; // fraction of global samples of NAPSAC
+	int nthreads;      // threads running the trials (0 = 1)
+	ransac_model_refining_function *refine; // local optimization
+	int lo_iterations; // refits of each new best model (0 = 4)
+
+	// output statistics
+	int ntrials;       // number of trials actually run
+	int nmodels;       // number of models verified
+	int nrejected;     // models rejected early by the sequential test
+	int nbailed;       // models abandoned because they can't beat the best
+	long nevaluations; // number of errors computed
+	int prosac_pool;   // size of the PROSAC pool at the last trial
+	int nrefits;       // refits computed by the local optimization
+	int nimproved;     // new best models improved by the refits
+};
+
+// number of trials needed to draw, with probability "confidence", at least
+// one good sample, when the probability of a good sample is "p_good"
+static int ransac_adaptive_ntrials(float confidence, double p_good)
 {
-	const int *a = (const int *)aa;
-	const int *b = (const int *)bb;
-	return (*a > *b) - (*a < *b);
+	if (p_good >= 1) return 0;
+	if (p_good <= 0) return INT_MAX;
+	double r = ceil(log(1 - confidence) / log1p(-p_good));
+	return r < INT_MAX ? r : INT_MAX;
 }
 
-// check whether a vector of n ints has different entries
-// (sorts the vector inplace)
-static bool are_different(int *t, int n)
+// smallest number of inliers among m points that happens with probability
+// less than 5% when each point is an inlier with probability beta (binomial
+// tail, by its gaussian approximation for large m)
+static int ransac_min_nonrandom_inliers(int m, double beta)
 {
-	qsort(t, n, sizeof*t, compare_ints);
-	for (int i = 1; i < n; i++)
-		if (t[i-1] == t[i])
-			return false;
-	return true;
+	if (m > 100)
+		return ceil(m * beta + 1.645 * sqrt(m * beta * (1 - beta)));
+	double p = pow(1 - beta, m); // P(X = j)
+	double tail = 1;             // P(X >= j)
+	for (int j = 0; j <= m; j++)
+	{
+		if (tail < 0.05)
+			return j;
+		tail -= p;
+		p *= (m - j) / (j + 1.0) * beta / (1 - beta);
+	}
+	return m + 1;
 }
 
-// generate a set of n different ints between a and b
-static void fill_random_indices(int *idx, int n, int a, int b)
+// PROSAC stopping criterion (Chum and Matas): the smallest number of trials
+// needed by the pools of the first m points (by decreasing quality) where the
+// number of inliers of the best model is not due to chance
+// ("beta" is the probability that a point is an inlier of a bad model, and
+// the whole set of points is always accepted, as in the usual criterion)
+static int ransac_prosac_ntrials(struct sampler *smp, int *mask,
+		float confidence, double beta, double p_accept, int nfit)
 {
-	if (b-a==n) {for(int i=0;i<n;i++)idx[i]=a+i;return;}
-	//if (5*n > (b-a)) {fill_random_shuffle(idx, n, a, b);return;}
-	// TODO fisher yates shuffle and traverse it by blocks of length nfit
-	int safecount = 0;
-	do {
+	int n = smp->n, r = INT_MAX, cx = 0;
+	for (int m = 1; m <= n; m++)
+	{
+		cx += mask[smp->order[m-1]];
+		if (m < nfit) continue;
+		if (m < n && cx - nfit <
+				ransac_min_nonrandom_inliers(m - nfit, beta))
+			continue;
+		double p_good = pow(cx / (double)m, nfit) * p_accept;
+		int t = ransac_adaptive_ntrials(confidence, p_good);
+		if (t < r) r = t;
+	}
+	return r;
+}
+
+// state of the sequential probability ratio test (Wald's SPRT, as in Matas
+// and Chum, "Randomized RANSAC with sequential decision making")
+struct ransac_sprt {
+	double epsilon;    // probability that a point is an inlier of a good model
+	double delta;      // probability that a point is an inlier of a bad model
+	double tmodel;     // cost of a model, in error evaluations
+	double A;          // decision threshold on the likelihood ratio
+	double delta_sum;  // running estimate of delta, from the rejected models
+	int delta_count;
+};
+
+// optimal threshold for the current epsilon and delta
+static void ransac_sprt_update_threshold(struct ransac_sprt *s)
+{
+	double e = s->epsilon, d = s->delta;
+	if (!(e > d)) { // the test can not tell good and bad models apart
+		s->A = INFINITY;
+		return;
+	}
+	double C = (1 - d) * log((1 - d) / (1 - e)) + d * log(d / e);
+	double A0 = s->tmodel * C + 1;
+	s->A = A0;
+	for (int i = 0; i < 10; i++) // fixed point of A = A0 + log(A)
+		s->A = A0 + log(s->A);
+}
+
+static void ransac_sprt_init(struct ransac_sprt *s, struct ransac_options *o)
+{
+	s->epsilon = o->sprt_epsilon > 0 ? o->sprt_epsilon : 0;
+	s->delta   = o->sprt_delta   > 0 ? o->sprt_delta   : 0.05;
+	s->tmodel  = o->sprt_tmodel  > 0 ? o->sprt_tmodel  : 20;
+	s->delta_sum = 0;
+	s->delta_count = 0;
+	ransac_sprt_update_threshold(s);
+}
+
+// update the estimate of delta with the inlier ratio of a rejected model
+static void ransac_sprt_observe(struct ransac_sprt *s, double ratio)
+{
+	s->delta_sum += ratio;
+	s->delta_count += 1;
+	double d = s->delta_sum / s->delta_count;
+	d = fmin(0.5, fmax(0.001, d));
+	if (fabs(d - s->delta) > 0.1 * s->delta) {
+		s->delta = d;
+		ransac_sprt_update_threshold(s);
+	}
+}
+
+// local optimization (Chum, Matas and Kittler, "Locally optimized RANSAC",
+// with the iterated least squares of Lebeda, Matas and Chum, "Fixing the
+// locally optimized RANSAC"): the model is refitted to the points within a
+// threshold that shrinks from RANSAC_LO_FACTOR*max_error to max_error, and
+// each refitted model that has at least as many inliers replaces the best one
+// "tmp" has room for n data points and "mask" for n flags
+// returns the number of inliers of the refined model
+#define RANSAC_LO_FACTOR 3
+static int ransac_local_optimization(float *model, int ninliers,
+		float *data, int datadim, int n, int modeldim, float max_error,
+		ransac_error_evaluation_function *mev,
+		ransac_model_refining_function *refine, int niterations,
+		float *tmp, int *mask, void *usr, struct ransac_options *opt)
+{
+	float candidate[modeldim];
+	for (int l = 0; l < modeldim; l++)
+		candidate[l] = model[l];
+	for (int it = 0; it < niterations; it++)
+	{
+		float f = niterations > 1 ? (niterations - 1 - it)
+			/ (niterations - 1.0) : 0;
+		float th = max_error * (1 + (RANSAC_LO_FACTOR - 1) * f);
+		int m = 0;
 		for (int i = 0; i < n; i++)
-			idx[i] = random_index(a, b);
-		safecount += 1;
-	} while (safecount < 100 && !are_different(idx, n));
-	if (safecount == 100)
-		fail("could not generate any model (%d %d)", n, b-a);
+		{
+			float *datai = data + i*datadim;
+			if (!(mev(candidate, datai, usr) < th)) continue;
+			for (int l = 0; l < datadim; l++)
+				tmp[m*datadim+l] = datai[l];
+			m += 1;
+		}
+		opt->nrefits += 1;
+		if (!refine(candidate, tmp, m, usr))
+			break;
+		bool finite = true;
+		for (int l = 0; l < modeldim; l++)
+			finite = finite && isfinite(candidate[l]);
+		if (!finite)
+			break;
+		int cx = ransac_trial(mask, data, candidate, max_error,
+				datadim, n, mev, usr);
+		if (cx >= ninliers) {
+			for (int l = 0; l < modeldim; l++)
+				model[l] = candidate[l];
+			ninliers = cx;
+		}
+	}
+	return ninliers;
 }
 
-#define MAX_MODELS 10
+// refit the model to all its inliers (the mask is overwritten)
+static void ransac_refit_to_inliers(float *model, int *mask, float *tmp,
+		float *data, int datadim, int n, int modeldim, float max_error,
+		ransac_error_evaluation_function *mev,
+		ransac_model_refining_function *refine,
+		void *usr, struct ransac_options *opt)
+{
+	int m = 0;
+	ransac_trial(mask, data, model, max_error, datadim, n, mev, usr);
+	for (int k = 0; k < n; k++)
+		if (mask[k])
+		{
+			for (int l = 0; l < datadim; l++)
+				tmp[m*datadim+l] = data[k*datadim+l];
+			m += 1;
+		}
+	float refined[modeldim];
+	bool finite = refine(refined, tmp, m, usr);
+	for (int l = 0; finite && l < modeldim; l++)
+		finite = isfinite(refined[l]);
+	if (finite)
+		for (int l = 0; l < modeldim; l++)
+			model[l] = refined[l];
+	opt->nrefits += 1;
+}
+
+// number of trials needed after a new best model with "ninliers" inliers,
+// according to the options (the mask is overwritten)
+// "p_accept" is the probability that the verification accepts a good model,
+// and "beta" the probability that a point is an inlier of a bad model
+static int ransac_needed_trials(struct ransac_options *opt,
+		struct sampler *smp, int *mask, float *model, int ninliers,
+		float *data, int datadim, float max_error,
+		ransac_error_evaluation_function *mev, void *usr,
+		double p_accept, double beta, int max_trials)
+{
+	int n = smp->n, nfit = smp->k, nt;
+	if (smp->method == SAMPLER_PROSAC) {
+		ransac_trial(mask, data, model, max_error, datadim, n, mev, usr);
+		nt = ransac_prosac_ntrials(smp, mask, opt->confidence,
+				beta, p_accept, nfit);
+	} else {
+		double p_good = pow(ninliers / (double)n, nfit);
+		nt = ransac_adaptive_ntrials(opt->confidence, p_good * p_accept);
+	}
+	if (nt < opt->min_trials)
+		nt = opt->min_trials;
+	return nt < max_trials ? nt : max_trials;
+}
+
+// prepare the sampler asked by the options, for at most "max_trials" trials
+// (NAPSAC uses the first two coordinates of each data point as its position)
+static void ransac_sampler_init(struct sampler *smp, struct ransac_options *o,
+		float *data, int datadim, int n, int nfit, int max_trials,
+		int nthreads)
+{
+	int method = o ? o->sampler : SAMPLER_FLOYD;
+	if (method == SAMPLER_NAPSAC)
+		sampler_init_napsac(smp, n, nfit, data, datadim,
+				o->napsac_radius, o->napsac_global, nthreads);
+	else
+		sampler_init(smp, method, n, nfit, o ? o->quality : NULL,
+				max_trials, nthreads);
+}
+
+// data shared by all the trials of a ransac run
+struct ransac_context {
+	float *data;
+	int datadim, n, modeldim, nfit;
+	float max_error;
+	ransac_error_evaluation_function *mev;
+	ransac_model_generating_function *mgen;
+	ransac_model_accepting_function *macc;
+	void *usr;
+	float *soa;        // copy of the data in struct-of-arrays form
+	ransac_batch_error_function *batch;
+	int *order;        // order of visit of the points
+	uint64_t seed;
+	struct sampler sampler[1];
+};
+
+// result of one trial (a sample, and the models generated from it)
+struct ransac_trial_result {
+	int ninliers;      // inliers of its best model (-1 if none beats best)
+	int nmodels;
+	int nrejected;
+	int nbailed;
+	long nevaluations;
+	int ndelta;        // inlier ratios of the models rejected by the test
+	double delta[MAX_MODELS];
+};
+
+// evaluate a model on the data points, in the given order (if any), and stop
+// as soon as it can not have more than "best" inliers, or, if "s" is given,
+// as soon as the sequential test rejects it
+// When there is a batch error function, the errors are computed by blocks on
+// the struct-of-arrays copy of the data points (which is in the given order).
+// returns the number of inliers, or -1 if the evaluation was stopped
+static int ransac_trial_bounded(struct ransac_context *c, float *model,
+		int best, struct ransac_sprt *s, struct ransac_trial_result *r)
+{
+	int n = c->n;
+	double lambda = 1;
+	double l_in  = s ? s->delta / s->epsilon : 1;
+	double l_out = s ? (1 - s->delta) / (1 - s->epsilon) : 1;
+	int B = c->soa ? RANSAC_BLOCK : 1;
+	int cx = 0;
+	for (int k0 = 0; k0 < n; k0 += B)
+	{
+		float err[RANSAC_BLOCK];
+		int m = n - k0 < B ? n - k0 : B;
+		if (c->soa)
+			c->batch(err, model, c->soa + k0, n, m, c->usr);
+		else
+			for (int q = 0; q < m; q++)
+			{
+				int i = c->order ? c->order[k0+q] : k0 + q;
+				err[q] = c->mev(model, c->data + i*c->datadim,
+						c->usr);
+			}
+		r->nevaluations += m;
+
+		for (int q = 0; q < m; q++)
+		{
+			int k = k0 + q;
+			float e = err[q];
+			if (!(e >= 0)) fprintf(stderr, "WARNING e = %g\n", e);
+			assert(e >= 0);
+			bool inlier = e < c->max_error;
+			cx += inlier;
+
+			if (s && (lambda *= inlier ? l_in : l_out) > s->A) {
+				r->nrejected += 1;
+				r->delta[r->ndelta++] = cx / (k + 1.0);
+				return -1;
+			}
+			if (cx + (n - k - 1) <= best) {
+				r->nbailed += 1;
+				return -1;
+			}
+		}
+	}
+	return cx;
+}
 
+// run the trial number "t": draw its sample from the stream "t" of the seed,
+// and verify its models against the best number of inliers so far
+// (this function only writes on "r" and "out_model", so that several trials
+// can run in parallel)
+static void ransac_run_trial(struct ransac_trial_result *r, float *out_model,
+		struct ransac_context *c, int t, int best, struct ransac_sprt *s)
+{
+	r->ninliers = -1;
+	r->nmodels = r->nrejected = r->nbailed = r->ndelta = 0;
+	r->nevaluations = 0;
+
+	int tid = 0;
+#ifdef _OPENMP
+	tid = omp_get_thread_num();
+#endif
+	struct random_state g[1];
+	random_seed_stream(g, c->seed, t);
+	int indices[c->nfit];
+	sampler_draw(c->sampler, tid, g, t, indices);
+
+	float x[c->nfit*c->datadim];
+	for (int j = 0; j < c->nfit; j++)
+	for (int k = 0; k < c->datadim; k++)
+		x[c->datadim*j + k] = c->data[c->datadim*indices[j] + k];
+
+	float model[c->modeldim*MAX_MODELS];
+	int nm = c->mgen(model, x, c->usr);
+	if (!nm)
+		return;
+	if (c->macc && !c->macc(model, c->usr))
+		return;
+
+	// generally, nm=1
+	for (int j = 0; j < nm; j++)
+	{
+		float *modelj = model + j*c->modeldim;
+		int n_inliers = ransac_trial_bounded(c, modelj, best, s, r);
+		r->nmodels += 1;
+		if (n_inliers > best)
+		{
+			best = r->ninliers = n_inliers;
+			for (int k = 0; k < c->modeldim; k++)
+				out_model[k] = modelj[k];
+		}
+	}
+}
 
 // RANSAC
 //
@@ -125,7 +503,37 @@ static void fill_random_indices(int *idx, int n, int a, int b)
 // by hand, and then the inliers of a model are defined as the data points
 // which fit the model up to the allowed error.  The RANSAC algorithm randomly
 // tries several models and keeps the one with the largest number of inliers.
-int ransac(
+//
+// When "opt" asks for a confidence, the number of trials is adapted to the
+// ratio of inliers of the best model found so far, so that the search stops
+// as soon as an all-inlier sample has been drawn with the given probability
+// (the parameter "ntrials" is then an upper bound).  With the PROSAC sampler,
+// the samples are first drawn among the points of highest quality, and the
+// ratio of inliers is that of the best non-random pool of top points.  With the
+// NAPSAC sampler, the samples are drawn among neighboring points, and the
+// number of trials is still that of uniform sampling (which is larger).
+//
+// When "opt" provides a refining function, each new best model is refitted
+// to its inliers a few times (local optimization), so that the good models
+// are found after fewer trials, and the final model is the least-squares fit
+// of the inliers of the best one.
+//
+// The evaluation of each model stops as soon as it can not beat the best
+// one.  When "opt" asks for it, the models are also verified by a sequential
+// probability ratio test on the points in random order, which rejects most of
+// the bad models after a few evaluations.  When "opt" provides a batch error
+// function, the data is copied in struct-of-arrays form and evaluated by
+// blocks.
+//
+// The sample of the trial number t is drawn from the stream t of the seed
+// in "opt" (or of a seed taken from "rand()" when there is no "opt").  On
+// several threads, the trials run by batches against the state (best model,
+// sequential test) of the end of the previous batch, and the results of each
+// batch are reduced in the order of the trials.  On a single thread, each
+// trial sees the state left by the previous one.  Thus, the result only
+// depends on the seed and on whether there are several threads.  When "opt"
+// asks for several threads, the model functions must be reentrant.
+int ransac_opt(
 		// output
 		//int *out_ninliers, // number of inliers
 		int *out_mask,    // array mask identifying the inliers
@@ -149,49 +557,161 @@ int ransac(
 
 		// decoration
 		ransac_model_accepting_function *macc,
-		void *usr
+		void *usr,
+
+		// optional parameters (may be NULL)
+		struct ransac_options *opt
 		)
 {
+	bool adaptive = opt && opt->confidence > 0;
+	int max_trials = ntrials;
+	uint64_t seed = opt ? opt->seed : (uint64_t)rand();
+	struct ransac_context c[1] = {{
+		.data = data, .datadim = datadim, .n = n,
+		.modeldim = modeldim, .nfit = nfit, .max_error = max_error,
+		.mev = mev, .mgen = mgen, .macc = macc, .usr = usr,
+		.soa = NULL, .batch = opt ? opt->batch_error : NULL,
+		.order = NULL, .seed = seed }};
+	if (opt) {
+		opt->nmodels = opt->nrejected = opt->nbailed = 0;
+		opt->nevaluations = 0;
+		opt->nrefits = opt->nimproved = 0;
+	}
+
+	// sequential test, on the points in random order
+	struct ransac_sprt sprt[1], *s = NULL;
+	if (opt && opt->sprt) {
+		s = sprt;
+		ransac_sprt_init(s, opt);
+		struct random_state g[1];
+		random_seed_stream(g, seed, UINT64_MAX);
+		c->order = xmalloc_int(n);
+		for (int k = 0; k < n; k++)
+			c->order[k] = k;
+		for (int k = n - 1; k > 0; k--)
+		{
+			int r = random_index(g, 0, k + 1);
+			int t = c->order[k];
+			c->order[k] = c->order[r];
+			c->order[r] = t;
+		}
+	}
+
+	// copy of the data for the batch error function, in the order of visit
+	if (c->batch) {
+		c->soa = xmalloc_float(datadim * n);
+		for (int k = 0; k < n; k++)
+		for (int l = 0; l < datadim; l++)
+			c->soa[l*n+k] = data[datadim*(s ? c->order[k] : k) + l];
+	}
 
 	int best_ninliers = 0;
 	float best_model[modeldim];
+	for (int l = 0; l < modeldim; l++)
+		best_model[l] = 0;
 	int *best_mask = xmalloc_int(n);
-	int *tmp_mask = xmalloc_int(n);
-
-	for (int i = 0; i < ntrials; i++)
+	struct ransac_trial_result res[RANSAC_BATCH];
+	float *res_model = xmalloc_float(RANSAC_BATCH * modeldim);
+	int nthreads = opt && opt->nthreads > 1 ? opt->nthreads : 1;
+	int batch = nthreads > 1 ? RANSAC_BATCH : 1;
+	ransac_sampler_init(c->sampler, opt, data, datadim, n, nfit, ntrials,
+			nthreads);
+	bool prosac = c->sampler->method == SAMPLER_PROSAC;
+	ransac_model_refining_function *refine = opt ? opt->refine : NULL;
+	int lo_iterations = opt && opt->lo_iterations > 0 ?
+		opt->lo_iterations : 4;
+	float *lo_data = refine ? xmalloc_float(n * datadim) : NULL;
+
+	int i = 0;
+	while (i < ntrials)
 	{
-		int indices[nfit];
-		fill_random_indices(indices, nfit, 0, n);
-
-		float x[nfit*datadim];
-		for (int j = 0; j < nfit; j++)
-		for (int k = 0; k < datadim; k++)
-			x[datadim*j + k] = data[datadim*indices[j] + k];
-
-		float model[modeldim*MAX_MODELS];
-		int nm = mgen(model, x, usr);
-		if (!nm)
-			continue;
-		if (macc && !macc(model, usr))
-			continue;
-
-		// generally, nm=1
-		for (int j = 0; j < nm; j++)
+		// run a batch of trials against a frozen state (or a single
+		// trial against the current state)
+		int m = ntrials - i < batch ? ntrials - i : batch;
+		if (nthreads > 1) {
+			struct ransac_sprt frozen[1];
+			if (s) *frozen = *s;
+			int frozen_best = best_ninliers;
+#pragma omp parallel for num_threads(nthreads) schedule(dynamic)
+			for (int k = 0; k < m; k++)
+				ransac_run_trial(res + k, res_model + k*modeldim,
+						c, i + k, frozen_best,
+						s ? frozen : NULL);
+		} else
+			ransac_run_trial(res, res_model, c, i, best_ninliers, s);
+
+		// reduce the batch in the order of the trials
+		for (int k = 0; k < m && i < ntrials; k++, i++)
 		{
-			float *modelj = model + j*modeldim;
-			int n_inliers = ransac_trial(tmp_mask, data, modelj,
-					max_error, datadim, n, mev, usr);
+			struct ransac_trial_result *r = res + k;
+			if (opt) {
+				opt->nmodels += r->nmodels;
+				opt->nrejected += r->nrejected;
+				opt->nbailed += r->nbailed;
+				opt->nevaluations += r->nevaluations;
+			}
+			double A = s ? s->A : 0;
+			for (int j = 0; s && j < r->ndelta; j++)
+				ransac_sprt_observe(s, r->delta[j]);
+			bool update = s && s->A != A;
+			if (r->ninliers > best_ninliers) {
+				best_ninliers = r->ninliers;
+				for (int l = 0; l < modeldim; l++)
+					best_model[l] = res_model[k*modeldim+l];
+				update = true;
+
+				// local optimization of the new best model
+				if (refine) {
+					int lo = ransac_local_optimization(
+						best_model, best_ninliers,
+						data, datadim, n, modeldim,
+						max_error, mev, refine,
+						lo_iterations, lo_data,
+						best_mask, usr, opt);
+					opt->nimproved += lo > best_ninliers;
+					best_ninliers = lo;
+				}
+
+				// update the sequential test
+				if (s) {
+					s->epsilon = best_ninliers / (double)n;
+					ransac_sprt_update_threshold(s);
+				}
+			}
 
-			if (n_inliers > best_ninliers)
-			{
-				best_ninliers = n_inliers;
-				for(int k = 0; k < modeldim; k++)
-					best_model[k] = modelj[k];
-				for(int k = 0; k < n; k++)
-					best_mask[k] = tmp_mask[k];
+			// update the number of trials needed, after a new best
+			// model or a new threshold of the test (a good model may
+			// be rejected by the sequential test, with probability
+			// at most 1/A)
+			if (adaptive && update && best_ninliers) {
+				double p_accept = s ? 1 - 1 / s->A : 1;
+				double beta = s ? s->delta : 0.05;
+				ntrials = ransac_needed_trials(opt, c->sampler,
+						best_mask, best_model,
+						best_ninliers, data, datadim,
+						max_error, mev, usr,
+						p_accept, beta, max_trials);
 			}
 		}
 	}
+	if (opt) {
+		opt->ntrials = i;
+		opt->prosac_pool = prosac && i ?
+			sampler_prosac_pool(c->sampler, i) : n;
+	}
+
+	// with local optimization, the final model is the least-squares fit
+	// of the inliers of the best one
+	if (refine && best_ninliers)
+		ransac_refit_to_inliers(best_model, best_mask, lo_data, data,
+				datadim, n, modeldim, max_error, mev, refine,
+				usr, opt);
+
+	// inliers of the best model (computed again with "mev", whose rounding
+	// may differ from that of the batch error function)
+	if (best_ninliers)
+		best_ninliers = ransac_trial(best_mask, data, best_model,
+				max_error, datadim, n, mev, usr);
 
 	int return_value = 0;
 	if (best_ninliers >= min_inliers)
@@ -211,8 +731,37 @@ int ransac(
 		for(int j = 0; j < n; j++)
 			out_mask[j] = best_mask[j];
 
+	sampler_free(c->sampler);
+	free(c->soa);
+	free(c->order);
+	free(res_model);
 	free(best_mask);
-	free(tmp_mask);
+	free(lo_data);
 
 	return return_value;
 }
+
+// RANSAC with a fixed number of trials (see "ransac_opt")
+int ransac(
+		int *out_mask,    // array mask identifying the inliers
+		float *out_model,  // model parameters
+		float *data,       // array of input data
+		int datadim,       // dimension of each data point
+		int n,             // number of data points
+		int modeldim,      // number of model parameters
+		ransac_error_evaluation_function *mev,
+		ransac_model_generating_function *mgen,
+		int nfit,          // data points needed to produce a model
+		int ntrials,       // number of models to try
+		int min_inliers,   // minimum allowed number of inliers
+		float max_error,   // maximum allowed error
+		ransac_model_accepting_function *macc,
+		void *usr
+		)
+{
+	return ransac_opt(out_mask, out_model, data, datadim, n, modeldim,
+			mev, mgen, nfit, ntrials, min_inliers, max_error,
+			macc, usr, NULL);
+}
+
+#endif//_RANSAC_C
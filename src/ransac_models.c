@@ -0,0 +1,38 @@
+// ransac specialized for the models of geometry.c (see ransac_template.c)
+
+#ifndef _RANSAC_MODELS_C
+#define _RANSAC_MODELS_C
+
+#include "ransac.c"
+#include "geometry.c"
+
+// ransac_line2d: straight lines (a,b,c) with a^2+b^2=1, from points (x,y)
+#define RANSAC_NAME ransac_line2d
+#define RANSAC_DATADIM 2
+#define RANSAC_MODELDIM 3
+#define RANSAC_NFIT 2
+#define RANSAC_ERROR distance_of_point_to_unit_line
+#define RANSAC_GENERATE straight_line_through_two_points
+#include "ransac_template.c"
+
+// ransac_homography: homographies H[9], from correspondences (x,y,x',y')
+#define RANSAC_NAME ransac_homography
+#define RANSAC_DATADIM 4
+#define RANSAC_MODELDIM 9
+#define RANSAC_NFIT 4
+#define RANSAC_ERROR homography_transfer_error
+#define RANSAC_GENERATE homography_from_four_pairs
+#define RANSAC_ACCEPT homography_is_acceptable
+#include "ransac_template.c"
+
+// ransac_affine: affine maps A[6], from correspondences (x,y,x',y')
+#define RANSAC_NAME ransac_affine
+#define RANSAC_DATADIM 4
+#define RANSAC_MODELDIM 6
+#define RANSAC_NFIT 3
+#define RANSAC_ERROR affine_transfer_error
+#define RANSAC_GENERATE affine_from_three_pairs
+#define RANSAC_ACCEPT affine_is_acceptable
+#include "ransac_template.c"
+
+#endif//_RANSAC_MODELS_C
@@ -0,0 +1,206 @@
+// RANSAC specialized at compile time for a given model
+//
+// This file is a template: it is included once for each model, after
+// defining the following macros, and it defines a function RANSAC_NAME
+//
+// RANSAC_NAME      name of the specialized function
+// RANSAC_DATADIM   dimension of each data point
+// RANSAC_MODELDIM  number of model parameters
+// RANSAC_NFIT      data points needed to produce a model
+// RANSAC_ERROR     error of a data point (a function with the signature of
+//                  "ransac_error_evaluation_function", preferably inline)
+// RANSAC_GENERATE  model from RANSAC_NFIT points (a function with the
+//                  signature of "ransac_model_generating_function")
+// RANSAC_ACCEPT    (optional) test of the models (a function with the
+//                  signature of "ransac_model_accepting_function")
+//
+// The dimensions are constants and the error and generating functions are
+// called directly, so that the compiler can inline them and unroll and
+// vectorize the verification loop, which runs by blocks of RANSAC_SPEC_BLOCK
+// points between the checks of the bail-out condition.
+//
+// The specialized function has the same arguments as "ransac_opt", without
+// the ones fixed by the macros.  It draws the same samples as "ransac_opt"
+// and it honors the same options, except "sprt", "batch_error" and
+// "nthreads" (it runs on one thread, and the evaluation of each model only
+// stops when it can not beat the best one).  Thus, it finds the same model
+// as "ransac_opt" with one thread and without sequential test, except that a
+// final model that is not finite gives 0 inliers (where "ransac_opt" fails).
+//
+// Example:
+//
+//	#define RANSAC_NAME ransac_line2d
+//	#define RANSAC_DATADIM 2
+//	#define RANSAC_MODELDIM 3
+//	#define RANSAC_NFIT 2
+//	#define RANSAC_ERROR distance_of_point_to_unit_line
+//	#define RANSAC_GENERATE straight_line_through_two_points
+//	#include "ransac_template.c"
+
+#include "ransac.c"
+
+#if !defined(RANSAC_NAME) || !defined(RANSAC_DATADIM) || \
+	!defined(RANSAC_MODELDIM) || !defined(RANSAC_NFIT) || \
+	!defined(RANSAC_ERROR) || !defined(RANSAC_GENERATE)
+#error "ransac_template.c: missing parameters"
+#endif
+
+#ifndef RANSAC_SPEC_BLOCK
+#define RANSAC_SPEC_BLOCK 64
+#define RANSAC_SPEC_CAT2(a,b) a ## b
+#define RANSAC_SPEC_CAT(a,b) RANSAC_SPEC_CAT2(a,b)
+#endif
+#define RANSAC_SPEC(x) RANSAC_SPEC_CAT(RANSAC_NAME, x)
+
+// number of inliers of a model, or -1 if it can not have more than "best"
+static int RANSAC_SPEC(_count)(float *model, float *data, int n,
+		float max_error, int best, void *usr, long *nevaluations)
+{
+	int cx = 0;
+	for (int i0 = 0; i0 < n; i0 += RANSAC_SPEC_BLOCK)
+	{
+		int m = n - i0 < RANSAC_SPEC_BLOCK ? n - i0 : RANSAC_SPEC_BLOCK;
+		float *x = data + i0 * RANSAC_DATADIM;
+		for (int q = 0; q < m; q++)
+			cx += RANSAC_ERROR(model, x + q*RANSAC_DATADIM, usr)
+				< max_error;
+		*nevaluations += m;
+		if (cx + (n - i0 - m) <= best)
+			return -1;
+	}
+	return cx;
+}
+
+// API: specialized ransac (see the beginning of this file)
+int RANSAC_NAME(
+		int *out_mask,     // array mask identifying the inliers
+		float *out_model,  // model parameters
+		float *data,       // array of input data
+		int n,             // number of data points
+		int ntrials,       // number of models to try
+		int min_inliers,   // minimum allowed number of inliers
+		float max_error,   // maximum allowed error
+		void *usr,
+		struct ransac_options *opt // optional parameters (may be NULL)
+		)
+{
+	bool adaptive = opt && opt->confidence > 0;
+	int max_trials = ntrials;
+	uint64_t seed = opt ? opt->seed : (uint64_t)rand();
+	long nevaluations = 0;
+	int nmodels = 0;
+	if (opt) {
+		opt->nrejected = opt->nbailed = 0;
+		opt->nrefits = opt->nimproved = 0;
+	}
+
+	struct sampler smp[1];
+	ransac_sampler_init(smp, opt, data, RANSAC_DATADIM, n, RANSAC_NFIT,
+			ntrials, 1);
+	ransac_model_refining_function *refine = opt ? opt->refine : NULL;
+	int lo_iterations = opt && opt->lo_iterations > 0 ?
+		opt->lo_iterations : 4;
+	float *lo_data = refine ? xmalloc_float(n * RANSAC_DATADIM) : NULL;
+
+	int best_ninliers = 0;
+	float best_model[RANSAC_MODELDIM] = {0};
+	int *best_mask = xmalloc_int(n);
+	int i;
+	for (i = 0; i < ntrials; i++)
+	{
+		// draw the sample of the trial i, as ransac_opt
+		struct random_state g[1];
+		random_seed_stream(g, seed, i);
+		int idx[RANSAC_NFIT];
+		sampler_draw(smp, 0, g, i, idx);
+		float x[RANSAC_NFIT * RANSAC_DATADIM];
+		for (int j = 0; j < RANSAC_NFIT; j++)
+		for (int k = 0; k < RANSAC_DATADIM; k++)
+			x[RANSAC_DATADIM*j+k] = data[RANSAC_DATADIM*idx[j]+k];
+
+		float model[RANSAC_MODELDIM * MAX_MODELS];
+		int nm = RANSAC_GENERATE(model, x, usr);
+#ifdef RANSAC_ACCEPT
+		if (nm && !RANSAC_ACCEPT(model, usr))
+			nm = 0;
+#endif
+		bool improved = false;
+		for (int j = 0; j < nm; j++)
+		{
+			float *modelj = model + j*RANSAC_MODELDIM;
+			int cx = RANSAC_SPEC(_count)(modelj, data, n, max_error,
+					best_ninliers, usr, &nevaluations);
+			nmodels += 1;
+			if (opt && cx < 0) opt->nbailed += 1;
+			if (cx <= best_ninliers) continue;
+			best_ninliers = cx;
+			for (int k = 0; k < RANSAC_MODELDIM; k++)
+				best_model[k] = modelj[k];
+			improved = true;
+		}
+		if (!improved)
+			continue;
+
+		// local optimization of the new best model
+		if (refine) {
+			int lo = ransac_local_optimization(best_model,
+					best_ninliers, data, RANSAC_DATADIM, n,
+					RANSAC_MODELDIM, max_error, RANSAC_ERROR,
+					refine, lo_iterations, lo_data,
+					best_mask, usr, opt);
+			opt->nimproved += lo > best_ninliers;
+			best_ninliers = lo;
+		}
+
+		// update the number of trials needed
+		if (adaptive)
+			ntrials = ransac_needed_trials(opt, smp, best_mask,
+					best_model, best_ninliers, data,
+					RANSAC_DATADIM, max_error, RANSAC_ERROR,
+					usr, 1, 0.05, max_trials);
+	}
+	if (opt) {
+		opt->ntrials = i;
+		opt->nmodels = nmodels;
+		opt->nevaluations = nevaluations;
+		opt->prosac_pool = smp->method == SAMPLER_PROSAC && i ?
+			sampler_prosac_pool(smp, i) : n;
+	}
+
+	if (refine && best_ninliers)
+		ransac_refit_to_inliers(best_model, best_mask, lo_data, data,
+				RANSAC_DATADIM, n, RANSAC_MODELDIM, max_error,
+				RANSAC_ERROR, refine, usr, opt);
+	if (best_ninliers)
+		best_ninliers = ransac_trial(best_mask, data, best_model,
+				max_error, RANSAC_DATADIM, n, RANSAC_ERROR, usr);
+
+	// a model that is not finite is no fit
+	for (int j = 0; j < RANSAC_MODELDIM; j++)
+		if (!isfinite(best_model[j]))
+			best_ninliers = 0;
+	if (!best_ninliers)
+		for (int j = 0; j < n; j++)
+			best_mask[j] = 0;
+
+	if (out_model)
+		for (int j = 0; j < RANSAC_MODELDIM; j++)
+			out_model[j] = best_model[j];
+	if (out_mask)
+		for (int j = 0; j < n; j++)
+			out_mask[j] = best_mask[j];
+
+	sampler_free(smp);
+	free(lo_data);
+	free(best_mask);
+	return best_ninliers >= min_inliers ? best_ninliers : 0;
+}
+
+#undef RANSAC_SPEC
+#undef RANSAC_NAME
+#undef RANSAC_DATADIM
+#undef RANSAC_MODELDIM
+#undef RANSAC_NFIT
+#undef RANSAC_ERROR
+#undef RANSAC_GENERATE
+#undef RANSAC_ACCEPT
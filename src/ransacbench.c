@@ -0,0 +1,86 @@
+// compare the running times of the generic and the specialized ransac
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ransac.c"
+#include "ransac_models.c"
+#include "pickopt.c"
+#include "seconds.c"
+
+// random points, a fraction "p" of them near a straight line
+static void fill_line_points(float *xy, int n, float p, float noise)
+{
+	for (int i = 0; i < n; i++)
+	{
+		float t = 500.0 * rand() / RAND_MAX;
+		float e = noise * (2.0 * rand() / RAND_MAX - 1);
+		if (i < p * n) {
+			xy[2*i+0] = t;
+			xy[2*i+1] = 0.5 * t + 20 + e;
+		} else {
+			xy[2*i+0] = t;
+			xy[2*i+1] = 500.0 * rand() / RAND_MAX;
+		}
+	}
+}
+
+static void print_result(char *name, double t, int nrep, int r,
+		struct ransac_options *o)
+{
+	t /= nrep;
+	printf("%-12s %6d inliers %8d trials %12ld evals %10.3f ms %8.2f ns/eval\n",
+			name, r, o->ntrials, o->nevaluations, 1000 * t,
+			1e9 * t / o->nevaluations);
+}
+
+int main(int c, char *v[])
+{
+	// extract named options
+	int n = atoi(pick_option(&c, &v, "n", "2000"));
+	int ntrials = atoi(pick_option(&c, &v, "t", "1000"));
+	int nrep = atoi(pick_option(&c, &v, "r", "20"));
+	float p = atof(pick_option(&c, &v, "p", "0.1"));
+	float max_err = atof(pick_option(&c, &v, "e", "1.5"));
+	if (c != 1)
+		return fprintf(stderr, "usage:\n\t%s [-n npoints] [-t ntrials] "
+				"[-p inlier_ratio] [-e max_err] [-r nrep]\n", *v);
+
+	float *xy = xmalloc_float(2 * n);
+	int *mask = xmalloc_int(n);
+	srand(1);
+	fill_line_points(xy, n, p, 0.5);
+	printf("%d points, %g inliers, %d trials, %d repetitions\n",
+			n, p, ntrials, nrep);
+
+	// fixed number of trials, without early stop
+	struct ransac_options o = { .seed = 1 };
+	float line[3];
+	int r = 0;
+	double t = seconds();
+	for (int i = 0; i < nrep; i++)
+		r = ransac_opt(mask, line, xy, 2, n, 3,
+				distance_of_point_to_straight_line,
+				straight_line_through_two_points, 2,
+				ntrials, 0, max_err, NULL, NULL, &o);
+	print_result("generic", seconds() - t, nrep, r, &o);
+
+	o.batch_error = distance_of_points_to_straight_line;
+	t = seconds();
+	for (int i = 0; i < nrep; i++)
+		r = ransac_opt(mask, line, xy, 2, n, 3,
+				distance_of_point_to_straight_line,
+				straight_line_through_two_points, 2,
+				ntrials, 0, max_err, NULL, NULL, &o);
+	print_result("batch", seconds() - t, nrep, r, &o);
+
+	o.batch_error = NULL;
+	t = seconds();
+	for (int i = 0; i < nrep; i++)
+		r = ransac_line2d(mask, line, xy, n, ntrials, 0, max_err,
+				NULL, &o);
+	print_result("specialized", seconds() - t, nrep, r, &o);
+
+	free(mask);
+	free(xy);
+	return 0;
+}
@@ -0,0 +1,362 @@
+// generation of random samples of k different indices among n
+//
+// Four methods are available, all of them without sorting nor retrying:
+//
+// SAMPLER_FLOYD    Floyd's algorithm, with a table of marks to test the
+//                  membership of each index in constant time
+// SAMPLER_SHUFFLE  partial Fisher-Yates shuffle of the first k positions of
+//                  a persistent permutation (the swaps are undone after each
+//                  sample, so that the permutation stays the same)
+// SAMPLER_PROSAC   progressive sampling (Chum and Matas, "Matching with
+//                  PROSAC - progressive sample consensus"): the points are
+//                  ranked by decreasing quality and the samples are drawn
+//                  from the top-ranked points, in a pool that grows with the
+//                  number of the trial, until it has all the points at the
+//                  last trial ("horizon")
+// SAMPLER_NAPSAC   spatially local sampling (Nasuto and Craddock, "NAPSAC:
+//                  high noise, high dimensional robust estimation"): the
+//                  first point is drawn uniformly, and the others among the
+//                  points of the 3x3 cells of a grid (of side "radius")
+//                  around it, except for a fraction of global samples
+//
+// Each sample only depends on the random generator and on the number of the
+// trial, so that the samples can be drawn from several threads (each thread
+// has its own scratch tables, indexed by "tid").
+
+#ifndef _SAMPLER_C
+#define _SAMPLER_C
+
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include "fail.c"
+#include "xmalloc.c"
+#include "random.c"
+
+#define SAMPLER_FLOYD 0
+#define SAMPLER_SHUFFLE 1
+#define SAMPLER_PROSAC 2
+#define SAMPLER_NAPSAC 3
+
+#define SAMPLER_PROSAC_TN 200000 // default horizon of PROSAC (all points)
+
+struct sampler {
+	int method;
+	int n;             // number of points
+	int k;             // size of the samples
+	int nthreads;
+
+	int *order;        // persistent permutation (by decreasing quality)
+	int *growth;       // PROSAC: last trial using the first m points (T'_m)
+
+	// NAPSAC: grid of the points, sorted by cells in row-major order
+	int gw, gh;        // size of the grid
+	int *cell;         // cell of each point
+	int *cell_start;   // first point of each cell, and end (gw*gh+1)
+	int *cell_idx;     // points sorted by cells
+	float global;      // probability of a global sample
+
+	// scratch tables of each thread
+	int **perm;        // copy of the permutation, for the swaps
+	int **mark;        // marks of the chosen indices (Floyd)
+	int *epoch;        // current mark of each thread
+	int **cand;        // candidate neighbors (NAPSAC)
+};
+
+// a point and its quality, to rank the points for PROSAC
+struct sampler_rank { float q; int i; };
+
+// by decreasing quality, and by increasing index among equal qualities
+static int compare_sampler_ranks(const void *aa, const void *bb)
+{
+	const struct sampler_rank *a = (const struct sampler_rank *)aa;
+	const struct sampler_rank *b = (const struct sampler_rank *)bb;
+	if (a->q != b->q)
+		return (a->q < b->q) - (a->q > b->q);
+	return (a->i > b->i) - (a->i < b->i);
+}
+
+// PROSAC growth function: number of trials after which the pool contains the
+// first m points, for m = k ... n, so that it has all of them after about
+// "horizon" trials
+static void sampler_fill_growth(int *growth, int n, int k, int horizon)
+{
+	double Tn = horizon; // average number of samples from the pool
+	for (int i = 0; i < k; i++)
+		Tn *= (k - i) / (double)(n - i);
+	double Tp = 1;
+	growth[k] = 1;
+	for (int m = k + 1; m <= n; m++)
+	{
+		double Tn1 = Tn * m / (m - k);
+		Tp += ceil(Tn1 - Tn);
+		Tn = Tn1;
+		growth[m] = Tp < INT_MAX ? Tp : INT_MAX;
+	}
+}
+
+// API: prepare a sampler of "k" indices among "n"
+// "quality" and "horizon" are only used by PROSAC ("quality" can be NULL for
+// the other methods): the pool grows from the best points to all of them in
+// about "horizon" trials, which should be the largest number of trials of the
+// run (or 0, for SAMPLER_PROSAC_TN)
+void sampler_init(struct sampler *s, int method, int n, int k,
+		float *quality, int horizon, int nthreads)
+{
+	if (k > n)
+		fail("sampler: can not draw %d different points among %d", k, n);
+	if (method == SAMPLER_PROSAC && !quality)
+		fail("sampler: PROSAC needs the quality of the points");
+	s->method = method;
+	s->n = n;
+	s->k = k;
+	s->nthreads = nthreads > 0 ? nthreads : 1;
+
+	s->order = xmalloc_int(n);
+	for (int i = 0; i < n; i++)
+		s->order[i] = i;
+	s->growth = NULL;
+	s->cell = s->cell_start = s->cell_idx = NULL;
+	s->gw = s->gh = 0;
+	s->global = 1;
+	if (method == SAMPLER_PROSAC) {
+		struct sampler_rank *r = xmalloc(n * sizeof*r);
+		for (int i = 0; i < n; i++)
+		{
+			r[i].q = quality[i];
+			r[i].i = i;
+		}
+		qsort(r, n, sizeof*r, compare_sampler_ranks);
+		for (int i = 0; i < n; i++)
+			s->order[i] = r[i].i;
+		free(r);
+		s->growth = xmalloc_int(n + 1);
+		sampler_fill_growth(s->growth, n, k,
+				horizon > 0 ? horizon : SAMPLER_PROSAC_TN);
+	}
+
+	s->perm = xmalloc(s->nthreads * sizeof*s->perm);
+	s->mark = xmalloc(s->nthreads * sizeof*s->mark);
+	s->epoch = xmalloc_int(s->nthreads);
+	s->cand = xmalloc(s->nthreads * sizeof*s->cand);
+	for (int t = 0; t < s->nthreads; t++)
+	{
+		s->perm[t] = NULL;
+		s->mark[t] = NULL;
+		s->cand[t] = NULL;
+		s->epoch[t] = 0;
+		if (method == SAMPLER_NAPSAC)
+			s->cand[t] = xmalloc_int(n);
+		if (method == SAMPLER_FLOYD || method == SAMPLER_NAPSAC) {
+			s->mark[t] = xmalloc_int(n);
+			for (int i = 0; i < n; i++)
+				s->mark[t][i] = 0;
+		} else {
+			s->perm[t] = xmalloc_int(n);
+			for (int i = 0; i < n; i++)
+				s->perm[t][i] = s->order[i];
+		}
+	}
+}
+
+// API: prepare a NAPSAC sampler of "k" indices among the "n" points of
+// coordinates (data[i*stride], data[i*stride+1])
+// "radius" is the side of the cells of the grid (0 = such that there are 8
+// points per cell on average), and "global" is the probability of drawing a
+// sample from all the points instead of a neighborhood
+void sampler_init_napsac(struct sampler *s, int n, int k,
+		float *data, int stride, float radius, float global,
+		int nthreads)
+{
+	if (n < k || n < 1)
+		fail("sampler: NAPSAC can not draw %d points among %d", k, n);
+	sampler_init(s, SAMPLER_NAPSAC, n, k, NULL, 0, nthreads);
+	s->global = global;
+
+	float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+	for (int i = 0; i < n; i++)
+	{
+		float *p = data + i*stride;
+		x0 = fmin(x0, p[0]); x1 = fmax(x1, p[0]);
+		y0 = fmin(y0, p[1]); y1 = fmax(y1, p[1]);
+	}
+	if (!(x1 - x0 >= 0 && x1 - x0 < INFINITY)) x0 = x1 = 0; // (no extent)
+	if (!(y1 - y0 >= 0 && y1 - y0 < INFINITY)) y0 = y1 = 0;
+	if (!(radius > 0))
+		radius = sqrt(8 * (x1 - x0) * (y1 - y0) / n);
+	if (!(radius > 0))
+		radius = 1;
+	s->gw = fmax(1, fmin(1024, 1 + (x1 - x0) / radius));
+	s->gh = fmax(1, fmin(1024, 1 + (y1 - y0) / radius));
+
+	// counting sort of the points by cell
+	int gw = s->gw, gh = s->gh;
+	s->cell = xmalloc_int(n);
+	s->cell_start = xmalloc_int(gw*gh + 1);
+	s->cell_idx = xmalloc_int(n);
+	for (int q = 0; q <= gw*gh; q++)
+		s->cell_start[q] = 0;
+	for (int i = 0; i < n; i++)
+	{
+		float *p = data + i*stride;
+		int ci = fmax(0, fmin(gw - 1, (p[0] - x0) / radius));
+		int cj = fmax(0, fmin(gh - 1, (p[1] - y0) / radius));
+		s->cell[i] = cj*gw + ci;
+		s->cell_start[s->cell[i]+1] += 1;
+	}
+	for (int q = 0; q < gw*gh; q++)
+		s->cell_start[q+1] += s->cell_start[q];
+	int *pos = xmalloc_int(gw*gh);
+	for (int q = 0; q < gw*gh; q++)
+		pos[q] = s->cell_start[q];
+	for (int i = 0; i < n; i++)
+		s->cell_idx[pos[s->cell[i]]++] = i;
+	free(pos);
+}
+
+// API
+void sampler_free(struct sampler *s)
+{
+	for (int t = 0; t < s->nthreads; t++)
+	{
+		free(s->perm[t]);
+		free(s->mark[t]);
+		free(s->cand[t]);
+	}
+	free(s->perm);
+	free(s->mark);
+	free(s->cand);
+	free(s->cell);
+	free(s->cell_start);
+	free(s->cell_idx);
+	free(s->epoch);
+	free(s->growth);
+	free(s->order);
+}
+
+// new mark for the table of marks of the thread
+static int sampler_new_epoch(struct sampler *s, int tid)
+{
+	int e = ++s->epoch[tid];
+	if (e == INT_MAX) { // renew the marks
+		for (int i = 0; i < s->n; i++)
+			s->mark[tid][i] = 0;
+		e = s->epoch[tid] = 1;
+	}
+	return e;
+}
+
+// k different elements of the array "a" of length m, by Floyd's algorithm
+// (the elements of "a" are indices of points, marked in the table of marks)
+static void sampler_floyd_array(struct sampler *s, int tid,
+		struct random_state *g, int *a, int m, int k, int *out_idx)
+{
+	int *mark = s->mark[tid];
+	int e = sampler_new_epoch(s, tid);
+	for (int j = m - k, c = 0; j < m; j++, c++)
+	{
+		int r = random_index_below(g, j + 1);
+		int v = mark[a ? a[r] : r] == e ? j : r;
+		v = a ? a[v] : v;
+		mark[v] = e;
+		out_idx[c] = v;
+	}
+}
+
+// k different indices among [0,n), by Floyd's algorithm
+static void sampler_floyd(struct sampler *s, int tid, struct random_state *g,
+		int *out_idx)
+{
+	sampler_floyd_array(s, tid, g, NULL, s->n, s->k, out_idx);
+}
+
+// a random point, and k-1 different points of the 3x3 cells around it
+// (or k different points anywhere, if there are not enough neighbors)
+static void sampler_napsac(struct sampler *s, int tid, struct random_state *g,
+		int *out_idx)
+{
+	if (!s->cell)
+		fail("sampler: NAPSAC needs sampler_init_napsac");
+	if (random_uniform(g) < s->global) {
+		sampler_floyd(s, tid, g, out_idx);
+		return;
+	}
+	int i = random_index_below(g, s->n);
+	int ci = s->cell[i] % s->gw, cj = s->cell[i] / s->gw;
+	int *cand = s->cand[tid], m = 0;
+	for (int j = cj - 1; j <= cj + 1; j++)
+	{
+		if (j < 0 || j >= s->gh) continue;
+		int a = j*s->gw + (ci > 0 ? ci - 1 : 0);
+		int b = j*s->gw + (ci + 1 < s->gw ? ci + 1 : ci);
+		for (int q = s->cell_start[a]; q < s->cell_start[b+1]; q++)
+			if (s->cell_idx[q] != i)
+				cand[m++] = s->cell_idx[q];
+	}
+	if (m < s->k - 1) {
+		sampler_floyd(s, tid, g, out_idx);
+		return;
+	}
+	out_idx[0] = i;
+	sampler_floyd_array(s, tid, g, cand, m, s->k - 1, out_idx + 1);
+}
+
+// the first k positions of a partial Fisher-Yates shuffle of the first m
+// positions of the permutation (the permutation is restored afterwards)
+static void sampler_shuffle_prefix(struct sampler *s, int tid,
+		struct random_state *g, int m, int k, int *out_idx)
+{
+	int *p = s->perm[tid];
+	int swapped[k > 0 ? k : 1];
+	for (int i = 0; i < k; i++)
+	{
+		int j = i + random_index_below(g, m - i);
+		swapped[i] = j;
+		int t = p[i]; p[i] = p[j]; p[j] = t;
+		out_idx[i] = p[i];
+	}
+	for (int i = k - 1; i >= 0; i--)
+	{
+		int j = swapped[i];
+		int t = p[i]; p[i] = p[j]; p[j] = t;
+	}
+}
+
+// size of the PROSAC pool at the trial t (the first m with T'_m >= t)
+static int sampler_prosac_pool(struct sampler *s, int t)
+{
+	int a = s->k, b = s->n;
+	if (s->growth[b] < t)
+		return b;
+	while (a < b)
+	{
+		int m = (a + b) / 2;
+		if (s->growth[m] >= t) b = m; else a = m + 1;
+	}
+	return a;
+}
+
+// API: draw the sample of the trial number "t" (counting from 0)
+void sampler_draw(struct sampler *s, int tid, struct random_state *g, int t,
+		int *out_idx)
+{
+	if (s->method == SAMPLER_FLOYD)
+		sampler_floyd(s, tid, g, out_idx);
+	else if (s->method == SAMPLER_SHUFFLE)
+		sampler_shuffle_prefix(s, tid, g, s->n, s->k, out_idx);
+	else if (s->method == SAMPLER_NAPSAC)
+		sampler_napsac(s, tid, g, out_idx);
+	else if (s->method == SAMPLER_PROSAC) {
+		// the last point of the pool, and k-1 points before it
+		int m = sampler_prosac_pool(s, t + 1);
+		if (s->growth[m] < t + 1) // the pool is complete
+			sampler_shuffle_prefix(s, tid, g, m, s->k, out_idx);
+		else {
+			sampler_shuffle_prefix(s, tid, g, m-1, s->k-1, out_idx);
+			out_idx[s->k-1] = s->order[m-1];
+		}
+	} else
+		fail("sampler: unknown method %d", s->method);
+}
+
+#endif//_SAMPLER_C
@@ -1,78 +1,229 @@
-#define MAX_NFRAMES 100
-#define MAX_NPOINTS 1000
+#ifndef _TRACKER_C
+#define _TRACKER_C
+
+#include <stdlib.h>
+#include "xmalloc.c"
+
+#define TRACKER_CELL 8          // side of the cells of the spatial hash
+#define TRACKER_NBUCKETS 4096   // number of buckets (a power of two)
+
+// ring of the last "nframes" frames of points, each stored as separate
+// arrays of coordinates, scales and scores (struct of arrays)
+//
+// The points of each frame are sorted by bucket of a spatial hash: the
+// points of the bucket b of frame f are those of indices k with
+// start[f][b] <= k < start[f][b+1].
 struct point_tracker {
 	int last_frame;
 	int nframes;
-	int n[MAX_NFRAMES];
-	float xyst[MAX_NFRAMES][MAX_NPOINTS][4];
+	int *n;          // number of points on each frame
+	int *capacity;   // number of allocated points on each frame
+	float **x;       // x coordinate of each point
+	float **y;       // y coordinate of each point
+	float **s;       // scale of each point
+	float **t;       // score of each point
+	int **start;     // first point of each bucket
 };
 
-void point_tracker_init(struct point_tracker *p, int nframes)
+// bucket of the cell (i,j) of the spatial hash
+static int tracker_bucket(int i, int j)
+{
+	unsigned int h = (unsigned int)i * 73856093u ^ (unsigned int)j * 19349663u;
+	return h & (TRACKER_NBUCKETS - 1);
+}
+
+static int tracker_cell(float x)
+{
+	return floor(x / TRACKER_CELL);
+}
+
+static void point_tracker_reserve(struct point_tracker *p, int f, int n)
+{
+	if (n <= p->capacity[f]) return;
+	int c = p->capacity[f];
+	while (c < n) c *= 2;
+	p->x[f] = realloc(p->x[f], c * sizeof(float));
+	p->y[f] = realloc(p->y[f], c * sizeof(float));
+	p->s[f] = realloc(p->s[f], c * sizeof(float));
+	p->t[f] = realloc(p->t[f], c * sizeof(float));
+	if (!p->x[f] || !p->y[f] || !p->s[f] || !p->t[f])
+		fail("tracker: out of memory for %d points", c);
+	p->capacity[f] = c;
+}
+
+// store the selected points of the array "xyst" into frame f, sorted by
+// bucket of the spatial hash (counting sort)
+static void point_tracker_store_frame(struct point_tracker *p, int f,
+		float *xyst, int *sel, int n)
 {
-	assert(nframes <= MAX_NFRAMES);
+	point_tracker_reserve(p, f, n);
+	int *start = p->start[f];
+	int *bucket = xmalloc_int(n ? n : 1);
+	for (int b = 0; b <= TRACKER_NBUCKETS; b++)
+		start[b] = 0;
+	for (int i = 0; i < n; i++)
+	{
+		float *X = xyst + 4*sel[i];
+		bucket[i] = tracker_bucket(tracker_cell(X[0]), tracker_cell(X[1]));
+		start[1+bucket[i]] += 1;
+	}
+	for (int b = 0; b < TRACKER_NBUCKETS; b++)
+		start[b+1] += start[b];
+	int *pos = xmalloc_int(TRACKER_NBUCKETS);
+	for (int b = 0; b < TRACKER_NBUCKETS; b++)
+		pos[b] = start[b];
+	for (int i = 0; i < n; i++)
+	{
+		float *X = xyst + 4*sel[i];
+		int k = pos[bucket[i]]++;
+		p->x[f][k] = X[0];
+		p->y[f][k] = X[1];
+		p->s[f][k] = X[2];
+		p->t[f][k] = X[3];
+	}
+	p->n[f] = n;
+	free(pos);
+	free(bucket);
+}
+
+// whether any of the points [k0,k1) of frame f is closer than sqrt(r2)
+static bool point_tracker_any_near(struct point_tracker *p, int f,
+		int k0, int k1, float x, float y, float r2)
+{
+	float *X = p->x[f];
+	float *Y = p->y[f];
+	int hit = 0;
+	for (int k = k0; k < k1; k++) // (vectorizable)
+	{
+		float dx = x - X[k];
+		float dy = y - Y[k];
+		hit |= dx*dx + dy*dy < r2;
+	}
+	return hit;
+}
+
+// whether frame f has a point at distance less than r from (x,y)
+static bool point_tracker_has_point_near(struct point_tracker *p, int f,
+		float x, float y, float r)
+{
+	int i0 = tracker_cell(x - r), i1 = tracker_cell(x + r);
+	int j0 = tracker_cell(y - r), j1 = tracker_cell(y + r);
+
+	// huge neighborhoods are cheaper to traverse linearly
+	if ((i1 - i0 + 1) * (j1 - j0 + 1) > p->n[f])
+		return point_tracker_any_near(p, f, 0, p->n[f], x, y, r*r);
+
+	// note: when several cells share a bucket, its points are visited
+	// more than once, which is harmless for this query
+	for (int j = j0; j <= j1; j++)
+	for (int i = i0; i <= i1; i++)
+	{
+		int b = tracker_bucket(i, j);
+		if (point_tracker_any_near(p, f,
+					p->start[f][b], p->start[f][b+1],
+					x, y, r*r))
+			return true;
+	}
+	return false;
+}
+
+// API: create a tracker for "nframes" frames, with room for "capacity"
+// points on each frame (frames with more points grow as needed)
+void point_tracker_init(struct point_tracker *p, int nframes, int capacity)
+{
+	if (capacity < 1) capacity = 1;
 	p->nframes = nframes;
+	p->n        = xmalloc_int(nframes);
+	p->capacity = xmalloc_int(nframes);
+	p->x = xmalloc(nframes * sizeof*p->x);
+	p->y = xmalloc(nframes * sizeof*p->y);
+	p->s = xmalloc(nframes * sizeof*p->s);
+	p->t = xmalloc(nframes * sizeof*p->t);
+	p->start = xmalloc(nframes * sizeof*p->start);
 
 	// init a whole cycle with no points
 	for (int i = 0; i < p->nframes; i++)
-		p->n[i] = 0;
+	{
+		p->capacity[i] = capacity;
+		p->x[i] = xmalloc_float(capacity);
+		p->y[i] = xmalloc_float(capacity);
+		p->s[i] = xmalloc_float(capacity);
+		p->t[i] = xmalloc_float(capacity);
+		p->start[i] = xmalloc_int(TRACKER_NBUCKETS + 1);
+		point_tracker_store_frame(p, i, NULL, NULL, 0);
+	}
 	p->last_frame = 0;
 }
 
-#include <stdlib.h>
+// API
+void point_tracker_free(struct point_tracker *p)
+{
+	for (int i = 0; i < p->nframes; i++)
+	{
+		free(p->x[i]);
+		free(p->y[i]);
+		free(p->s[i]);
+		free(p->t[i]);
+		free(p->start[i]);
+	}
+	free(p->x);
+	free(p->y);
+	free(p->s);
+	free(p->t);
+	free(p->start);
+	free(p->n);
+	free(p->capacity);
+}
+
+// copy the point k of frame f into a (x,y,s,t) record
+static void point_tracker_get(float *out_xyst, struct point_tracker *p,
+		int f, int k)
+{
+	out_xyst[0] = p->x[f][k];
+	out_xyst[1] = p->y[f][k];
+	out_xyst[2] = p->s[f][k];
+	out_xyst[3] = p->t[f][k];
+}
 
 // API
 void point_tracker_add_frame(struct point_tracker *p, float *xyst, int n)
 {
 	//fprintf(stderr, "ADD FRAME %d (%d) %d\n", p->last_frame, p->nframes, n);
-	if (n > MAX_NPOINTS) {
-		fprintf(stderr, "warning: tracker got %d points but "
-				"MAX_NPOINTS is %d\n", n, MAX_NPOINTS);
-		n = MAX_NPOINTS;
-	}
 	p->last_frame = (1 + p->last_frame) % p->nframes;
-	p->n[p->last_frame] = n;
+	int *sel = xmalloc_int(n ? n : 1);
 	for (int i = 0; i < n; i++)
-	for (int k = 0; k < 4; k++)
-		p->xyst[p->last_frame][i][k] = xyst[4*i+k];
-}
-
-static float dist(float *a, float *b)
-{
-	return hypot(a[0] - b[0], a[1] - b[1]);
+		sel[i] = i;
+	point_tracker_store_frame(p, p->last_frame, xyst, sel, n);
+	free(sel);
 }
 
 static int comes_from_the_past_p(struct point_tracker *p, float *xyst)
 {
 	for (int i = 0; i < p->nframes; i++)
-	for (int j = 0; j < p->n[i]; j++)
 	if (i != p->last_frame)
-	if (dist(xyst, p->xyst[i][j]) < 8.5)
+	if (point_tracker_has_point_near(p, i, xyst[0], xyst[1], 8.5))
 		return true;
 	return false;
 }
 
-static int comes_from_the_past(struct point_tracker *p, int idx)
-{
-	float *xyst = p->xyst[p->last_frame][idx];
-	return comes_from_the_past_p(p, xyst);
-}
-
 
 // API
 int point_tracker_extract_points_old(float *out_xyst, struct point_tracker *p,
 		float hysteresis_hi /*, float ... */ )
 {
+	int f = p->last_frame;
 	int n_out = 0;
-	for (int i = 0; i < p->n[p->last_frame]; i++)
+	for (int i = 0; i < p->n[f]; i++)
 	{
-		float *xyst = p->xyst[p->last_frame][i];
-		if (xyst[3] > hysteresis_hi || comes_from_the_past(p, i))
+		float xyst[4];
+		point_tracker_get(xyst, p, f, i);
+		if (xyst[3] > hysteresis_hi || comes_from_the_past_p(p, xyst))
 		{
 			for (int k = 0; k < 4; k++)
 				out_xyst[4*n_out+k] = xyst[k];
 			n_out += 1;
 		} else {
-			xyst[3] = -INFINITY;
+			p->t[f][i] = -INFINITY;
 		}
 	}
 	return n_out;
@@ -82,15 +233,14 @@ static int appears_later(struct point_tracker *p, int frame_idx, int point_idx)
 {
 	if (frame_idx == p->last_frame)
 		return false;
-	float *xyst = p->xyst[frame_idx][point_idx];
+	float x = p->x[frame_idx][point_idx];
+	float y = p->y[frame_idx][point_idx];
+	float s = p->s[frame_idx][point_idx];
 	for (int jj = 0; jj < p->nframes; jj++)
 	{
 		int j = (frame_idx + jj + 1) % p->nframes;
-		for (int i = 0; i < p->n[j]; i++)
-		{
-			if (dist(xyst,p->xyst[j][i]) < 3.5*xyst[2])
-				return true;
-		}
+		if (point_tracker_has_point_near(p, j, x, y, 3.5*s))
+			return true;
 		if (j == p->last_frame)
 			break;
 	}
@@ -102,43 +252,37 @@ void point_tracker_add_frame_t(struct point_tracker *p, float *xyst, int n,
 		float hysteresis_hi)
 {
 	fprintf(stderr, "ADD FRAME %d (%d) %d {%g}\n", p->last_frame, p->nframes, n, hysteresis_hi);
-	if (n > MAX_NPOINTS) {
-		fprintf(stderr, "warning: tracker got %d points but "
-				"MAX_NPOINTS is %d\n", n, MAX_NPOINTS);
-		n = MAX_NPOINTS;
-	}
 	p->last_frame = (1 + p->last_frame) % p->nframes;
 
+	int *sel = xmalloc_int(n ? n : 1);
 	int cx = 0;
 	for (int i = 0; i < n; i++)
 	{
 		float *X = xyst + 4*i;
 		if (X[3] > hysteresis_hi || comes_from_the_past_p(p, X))
-		{
-			for (int k = 0; k < 4; k++)
-				p->xyst[p->last_frame][cx][k] = X[k];
-			cx += 1;
-		}
+			sel[cx++] = i;
 	}
-	p->n[p->last_frame] = cx;
+	point_tracker_store_frame(p, p->last_frame, xyst, sel, cx);
+	free(sel);
 }
 
 
 
-int point_tracker_extract_points(float *out_xyst, struct point_tracker *p)
+// API: extract the points that are not seen again on a later frame
+// (at most max_npoints)
+int point_tracker_extract_points(float *out_xyst, int max_npoints,
+		struct point_tracker *p)
 {
 	int n_out = 0;
 	for (int j = 0; j < p->nframes; j++)
 	{
 		fprintf(stderr, "%d%c:%d ", j, j==p->last_frame?'\'':'_',
 				p->n[j]);
-		for (int i = 0; i < p->n[j]; i++)
+		for (int i = 0; i < p->n[j] && n_out < max_npoints; i++)
 		{
 			if (!appears_later(p, j, i))
 			{
-				float *xyst = p->xyst[j][i];
-				for (int k = 0; k < 4; k++)
-					out_xyst[4*n_out+k] = xyst[k];
+				point_tracker_get(out_xyst + 4*n_out, p, j, i);
 				n_out += 1;
 			}
 		}
@@ -146,3 +290,5 @@ int point_tracker_extract_points(float *out_xyst, struct point_tracker *p)
 	fprintf(stderr, "\n");
 	return n_out;
 }
+
+#endif//_TRACKER_C
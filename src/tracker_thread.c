@@ -0,0 +1,214 @@
+// point tracker running on its own thread, pipelined with the detector
+//
+// The detector pushes the keypoints of frame N and goes on with frame N+1,
+// while a worker thread runs "point_tracker_add_frame_t" and
+// "point_tracker_extract_points" on frame N.  The frames and the results
+// travel through two single-producer single-consumer rings, synchronized
+// only by atomic loads and stores of their head and tail counters.  A side
+// that has to wait (the idle worker, or the detector on a full ring) sleeps
+// on a condition variable, signalled after each push and pop.  The result of frame N is returned after the push of frame N+latency, so that
+// the output is delayed by a bounded number of frames.
+
+#ifndef _TRACKER_THREAD_C
+#define _TRACKER_THREAD_C
+
+#include <pthread.h>
+#include "xmalloc.c"
+#include "tracker.c"
+
+#define TRACKER_PIPELINE_SLOTS 4   // capacity of each ring
+
+struct tracker_slot {
+	int n;
+	float *xyst;
+	float hysteresis_hi;
+};
+
+// single-producer single-consumer ring: "head" is written only by the
+// producer and "tail" only by the consumer (they never wrap, the slot of
+// index k is k % TRACKER_PIPELINE_SLOTS)
+struct tracker_ring {
+	struct tracker_slot s[TRACKER_PIPELINE_SLOTS];
+	unsigned int head;
+	unsigned int tail;
+};
+
+struct tracker_pipeline {
+	struct point_tracker *p;
+	int max_npoints;
+	int latency;                 // number of frames of delay of the output
+	struct tracker_ring in[1];   // keypoints, from the detector to the worker
+	struct tracker_ring out[1];  // results, from the worker to the detector
+	int quit;
+	pthread_t thread;
+	pthread_mutex_t lock;        // only for sleeping, not for the rings
+	pthread_cond_t wake;         // signalled after each push, pop and quit
+};
+
+static void tracker_ring_init(struct tracker_ring *r, int max_npoints)
+{
+	for (int i = 0; i < TRACKER_PIPELINE_SLOTS; i++)
+	{
+		r->s[i].n = 0;
+		r->s[i].xyst = xmalloc_float(4 * max_npoints);
+	}
+	r->head = r->tail = 0;
+}
+
+static void tracker_ring_free(struct tracker_ring *r)
+{
+	for (int i = 0; i < TRACKER_PIPELINE_SLOTS; i++)
+		free(r->s[i].xyst);
+}
+
+// slot where the producer can write, or NULL if the ring is full
+static struct tracker_slot *tracker_ring_back(struct tracker_ring *r)
+{
+	unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	if (r->head - tail >= TRACKER_PIPELINE_SLOTS)
+		return NULL;
+	return r->s + r->head % TRACKER_PIPELINE_SLOTS;
+}
+
+static void tracker_ring_push(struct tracker_ring *r)
+{
+	__atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+// slot where the consumer can read, or NULL if the ring is empty
+static struct tracker_slot *tracker_ring_front(struct tracker_ring *r)
+{
+	unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	if (head == r->tail)
+		return NULL;
+	return r->s + r->tail % TRACKER_PIPELINE_SLOTS;
+}
+
+static void tracker_ring_pop(struct tracker_ring *r)
+{
+	__atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+// wake up the other side after a push, a pop or a quit
+static void tracker_pipeline_signal(struct tracker_pipeline *t)
+{
+	pthread_mutex_lock(&t->lock);
+	pthread_cond_broadcast(&t->wake);
+	pthread_mutex_unlock(&t->lock);
+}
+
+static int tracker_pipeline_quitting(struct tracker_pipeline *t)
+{
+	return __atomic_load_n(&t->quit, __ATOMIC_ACQUIRE);
+}
+
+static void *tracker_pipeline_worker(void *usr)
+{
+	struct tracker_pipeline *t = usr;
+	while (!tracker_pipeline_quitting(t))
+	{
+		struct tracker_slot *a = tracker_ring_front(t->in);
+		if (!a) { // idle: sleep until the detector sends a frame
+			pthread_mutex_lock(&t->lock);
+			while (!tracker_ring_front(t->in)
+					&& !tracker_pipeline_quitting(t))
+				pthread_cond_wait(&t->wake, &t->lock);
+			pthread_mutex_unlock(&t->lock);
+			continue;
+		}
+		point_tracker_add_frame_t(t->p, a->xyst, a->n, a->hysteresis_hi);
+		tracker_ring_pop(t->in);
+
+		// the results ring has room for all the frames in flight
+		struct tracker_slot *b;
+		pthread_mutex_lock(&t->lock);
+		while (!(b = tracker_ring_back(t->out)))
+			pthread_cond_wait(&t->wake, &t->lock);
+		pthread_mutex_unlock(&t->lock);
+		b->n = point_tracker_extract_points(b->xyst, t->max_npoints, t->p);
+		tracker_ring_push(t->out);
+		tracker_pipeline_signal(t);
+	}
+	return NULL;
+}
+
+// API: start the worker thread of the tracker "p"
+void tracker_pipeline_start(struct tracker_pipeline *t,
+		struct point_tracker *p, int max_npoints, int latency)
+{
+	if (latency < 0 || latency >= TRACKER_PIPELINE_SLOTS)
+		fail("tracker_pipeline: bad latency %d", latency);
+	t->p = p;
+	t->max_npoints = max_npoints;
+	t->latency = latency;
+	tracker_ring_init(t->in, max_npoints);
+	tracker_ring_init(t->out, max_npoints);
+	t->quit = 0;
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->wake, NULL);
+	if (pthread_create(&t->thread, NULL, tracker_pipeline_worker, t))
+		fail("tracker_pipeline: could not create thread");
+}
+
+// API: stop the worker thread (the frames in flight are discarded)
+void tracker_pipeline_stop(struct tracker_pipeline *t)
+{
+	__atomic_store_n(&t->quit, 1, __ATOMIC_RELEASE);
+	tracker_pipeline_signal(t);
+	pthread_join(t->thread, NULL);
+	pthread_cond_destroy(&t->wake);
+	pthread_mutex_destroy(&t->lock);
+	tracker_ring_free(t->in);
+	tracker_ring_free(t->out);
+}
+
+// API: send the keypoints of a new frame to the tracker, and get the
+// filtered keypoints of the frame "latency" frames before, if any
+// returns the number of output points, or -1 while the pipeline fills up
+int tracker_pipeline_update(struct tracker_pipeline *t,
+		float *out_xyst, float *xyst, int n, float hysteresis_hi)
+{
+	if (n > t->max_npoints) n = t->max_npoints;
+	struct tracker_slot *a;
+	pthread_mutex_lock(&t->lock);
+	while (!(a = tracker_ring_back(t->in)))
+		pthread_cond_wait(&t->wake, &t->lock);
+	pthread_mutex_unlock(&t->lock);
+	for (int i = 0; i < 4*n; i++)
+		a->xyst[i] = xyst[i];
+	a->n = n;
+	a->hysteresis_hi = hysteresis_hi;
+	tracker_ring_push(t->in);
+	tracker_pipeline_signal(t);
+
+	// number of frames sent whose result has not been taken yet
+	if (t->in->head - t->out->tail <= (unsigned int)t->latency)
+		return -1;
+	struct tracker_slot *b;
+	pthread_mutex_lock(&t->lock);
+	while (!(b = tracker_ring_front(t->out)))
+		pthread_cond_wait(&t->wake, &t->lock);
+	pthread_mutex_unlock(&t->lock);
+	for (int i = 0; i < 4*b->n; i++)
+		out_xyst[i] = b->xyst[i];
+	int r = b->n;
+	tracker_ring_pop(t->out);
+	tracker_pipeline_signal(t);
+	return r;
+}
+
+// API: wait until the worker has processed all the frames sent, and drop
+// their results (after this, the tracker can be used by the caller)
+void tracker_pipeline_flush(struct tracker_pipeline *t)
+{
+	pthread_mutex_lock(&t->lock);
+	while (t->in->head != t->out->tail)
+		if (tracker_ring_front(t->out)) {
+			tracker_ring_pop(t->out);
+			pthread_cond_broadcast(&t->wake);
+		} else
+			pthread_cond_wait(&t->wake, &t->lock);
+	pthread_mutex_unlock(&t->lock);
+}
+
+#endif//_TRACKER_THREAD_C
@@ -0,0 +1,260 @@
+// tracker of keypoint identities, with constant-velocity prediction
+//
+// Each track has a persistent id, a position and a velocity.  On each frame
+// the tracks are predicted one frame ahead, the new detections are
+// associated to the predictions by gated nearest neighbor (greedy on the
+// sorted list of candidate pairs), and the matched tracks are corrected by
+// an alpha-beta filter (the steady-state Kalman filter of the constant
+// velocity model).  The predicted positions define the search windows where
+// the next frame needs to be examined.
+
+#ifndef _TRACKS_C
+#define _TRACKS_C
+
+#include <math.h>
+#include <stdlib.h>
+#include "xmalloc.c"
+
+struct track {
+	int id;
+	float x, y;       // filtered position
+	float vx, vy;     // velocity (pixels per frame)
+	float s, score;   // scale and score of the last detection
+	int hits;         // number of frames where it was detected
+	int misses;       // number of consecutive frames without detection
+};
+
+struct track_set {
+	int n;            // number of live tracks
+	int capacity;
+	struct track *t;
+	int next_id;
+	int nframes;      // number of frames since the last full detection
+
+	// parameters
+	float gate;       // association radius (in pixels)
+	float alpha;      // gain of the position correction
+	float beta;       // gain of the velocity correction
+	int max_misses;   // frames to keep a track without detections
+};
+
+void track_set_init(struct track_set *ts, int capacity)
+{
+	ts->n = 0;
+	ts->capacity = capacity;
+	ts->t = xmalloc(capacity * sizeof*ts->t);
+	ts->next_id = 0;
+	ts->nframes = 0;
+	ts->gate = 6;
+	ts->alpha = 0.7;
+	ts->beta = 0.3;
+	ts->max_misses = 3;
+}
+
+void track_set_free(struct track_set *ts)
+{
+	free(ts->t);
+}
+
+// candidate association between a track and a detection
+struct track_pair { float d; int t, k; };
+
+static int compare_track_pairs(const void *aa, const void *bb)
+{
+	const struct track_pair *a = (const struct track_pair *)aa;
+	const struct track_pair *b = (const struct track_pair *)bb;
+	return (a->d > b->d) - (a->d < b->d);
+}
+
+// sort the detections into a grid of cells of side "c" (counting sort)
+// the detections of cell q are idx[start[q]] ... idx[start[q+1]-1]
+static void track_grid(int *start, int *idx, float *xyst, int n,
+		float x0, float y0, float c, int gw, int gh)
+{
+	int *cell = xmalloc_int(n ? n : 1);
+	for (int q = 0; q <= gw * gh; q++)
+		start[q] = 0;
+	for (int k = 0; k < n; k++)
+	{
+		int i = fmin(gw - 1, (xyst[4*k+0] - x0) / c);
+		int j = fmin(gh - 1, (xyst[4*k+1] - y0) / c);
+		cell[k] = j*gw + i;
+		start[cell[k]+1] += 1;
+	}
+	for (int q = 0; q < gw * gh; q++)
+		start[q+1] += start[q];
+	int *pos = xmalloc_int(gw * gh);
+	for (int q = 0; q < gw * gh; q++)
+		pos[q] = start[q];
+	for (int k = 0; k < n; k++)
+		idx[pos[cell[k]]++] = k;
+	free(pos);
+	free(cell);
+}
+
+// API: update the tracks with the detections of a new frame
+// returns the number of detections that were associated to a track
+int track_set_update(struct track_set *ts, float *xyst, int n)
+{
+	ts->nframes += 1;
+
+	// predict
+	for (int i = 0; i < ts->n; i++)
+	{
+		ts->t[i].x += ts->t[i].vx;
+		ts->t[i].y += ts->t[i].vy;
+	}
+
+	// grid of the detections, to find the candidates near each track
+	float x0 = INFINITY, y0 = INFINITY, x1 = -INFINITY, y1 = -INFINITY;
+	for (int k = 0; k < n; k++)
+	{
+		x0 = fmin(x0, xyst[4*k+0]); x1 = fmax(x1, xyst[4*k+0]);
+		y0 = fmin(y0, xyst[4*k+1]); y1 = fmax(y1, xyst[4*k+1]);
+	}
+	float c = ts->gate;
+	int gw = n ? 1 + (x1 - x0) / c : 1;
+	int gh = n ? 1 + (y1 - y0) / c : 1;
+	int *start = xmalloc_int(gw * gh + 1);
+	int *idx = xmalloc_int(n ? n : 1);
+	track_grid(start, idx, xyst, n, x0, y0, c, gw, gh);
+
+	// list the pairs (track, detection) inside the gate
+	int npairs = 0, cpairs = 4 * (n + ts->n) + 1;
+	struct track_pair *pair = xmalloc(cpairs * sizeof*pair);
+	for (int t = 0; t < ts->n && n; t++)
+	{
+		struct track *T = ts->t + t;
+		int i0 = fmax(0, floor((T->x - x0) / c) - 1);
+		int j0 = fmax(0, floor((T->y - y0) / c) - 1);
+		int i1 = fmin(gw - 1, floor((T->x - x0) / c) + 1);
+		int j1 = fmin(gh - 1, floor((T->y - y0) / c) + 1);
+		for (int j = j0; j <= j1; j++)
+		for (int i = i0; i <= i1; i++)
+		for (int q = start[j*gw+i]; q < start[j*gw+i+1]; q++)
+		{
+			float *X = xyst + 4*idx[q];
+			float d = hypot(X[0] - T->x, X[1] - T->y);
+			if (d >= ts->gate) continue;
+			if (fabs(log2(X[2] / T->s)) > 1.5) continue;
+			if (npairs == cpairs) {
+				cpairs *= 2;
+				pair = realloc(pair, cpairs * sizeof*pair);
+				if (!pair) fail("track_set_update: out of memory");
+			}
+			pair[npairs].d = d;
+			pair[npairs].t = t;
+			pair[npairs].k = idx[q];
+			npairs += 1;
+		}
+	}
+
+	// greedy association, from the closest pairs
+	qsort(pair, npairs, sizeof*pair, compare_track_pairs);
+	int *track_det = xmalloc_int(ts->n ? ts->n : 1);
+	int *det_used = xmalloc_int(n ? n : 1);
+	for (int t = 0; t < ts->n; t++) track_det[t] = -1;
+	for (int k = 0; k < n; k++) det_used[k] = 0;
+	int nmatched = 0;
+	for (int p = 0; p < npairs; p++)
+		if (track_det[pair[p].t] < 0 && !det_used[pair[p].k])
+		{
+			track_det[pair[p].t] = pair[p].k;
+			det_used[pair[p].k] = 1;
+			nmatched += 1;
+		}
+
+	// correct the matched tracks, and remove the lost ones
+	int cx = 0;
+	for (int t = 0; t < ts->n; t++)
+	{
+		struct track T = ts->t[t];
+		int k = track_det[t];
+		if (k >= 0) {
+			float *X = xyst + 4*k;
+			float rx = X[0] - T.x;
+			float ry = X[1] - T.y;
+			T.x += ts->alpha * rx;
+			T.y += ts->alpha * ry;
+			T.vx += ts->beta * rx;
+			T.vy += ts->beta * ry;
+			T.s = X[2];
+			T.score = X[3];
+			T.hits += 1;
+			T.misses = 0;
+		} else
+			T.misses += 1;
+		if (T.misses <= ts->max_misses)
+			ts->t[cx++] = T;
+	}
+	ts->n = cx;
+
+	// start new tracks on the unmatched detections
+	for (int k = 0; k < n && ts->n < ts->capacity; k++)
+		if (!det_used[k])
+		{
+			struct track *T = ts->t + ts->n++;
+			T->id = ts->next_id++;
+			T->x = xyst[4*k+0];
+			T->y = xyst[4*k+1];
+			T->vx = T->vy = 0;
+			T->s = xyst[4*k+2];
+			T->score = xyst[4*k+3];
+			T->hits = 1;
+			T->misses = 0;
+		}
+
+	free(det_used);
+	free(track_det);
+	free(pair);
+	free(idx);
+	free(start);
+	return nmatched;
+}
+
+// API: extract the tracks detected on the last frame, with at least
+// "min_hits" detections (the ids are optional)
+int track_set_extract(float *out_xyst, int *out_id, int max_npoints,
+		struct track_set *ts, int min_hits)
+{
+	int n = 0;
+	for (int i = 0; i < ts->n && n < max_npoints; i++)
+	{
+		struct track *T = ts->t + i;
+		if (T->misses || T->hits < min_hits) continue;
+		out_xyst[4*n+0] = T->x;
+		out_xyst[4*n+1] = T->y;
+		out_xyst[4*n+2] = T->s;
+		out_xyst[4*n+3] = T->score;
+		if (out_id) out_id[n] = T->id;
+		n += 1;
+	}
+	return n;
+}
+
+// API: search windows (x0, y0, x1, y1) around the positions predicted for
+// the next frame, of radius "margin" plus a multiple of the scale and of the
+// speed of each track (at most max_nrects)
+int track_set_search_windows(int *out_rects, int max_nrects,
+		struct track_set *ts, float margin, int w, int h)
+{
+	int n = 0;
+	for (int i = 0; i < ts->n && n < max_nrects; i++)
+	{
+		struct track *T = ts->t + i;
+		float px = T->x + T->vx;
+		float py = T->y + T->vy;
+		float r = margin + 2 * T->s + hypot(T->vx, T->vy)
+			+ T->misses * ts->gate;
+		int *R = out_rects + 4*n;
+		R[0] = fmax(0, px - r);
+		R[1] = fmax(0, py - r);
+		R[2] = fmin(w - 1, px + r);
+		R[3] = fmin(h - 1, py + r);
+		if (R[0] <= R[2] && R[1] <= R[3])
+			n += 1;
+	}
+	return n;
+}
+
+#endif//_TRACKS_C